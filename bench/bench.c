@@ -0,0 +1,153 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "heap.h"
+#include "perf_counters.h"
+
+/**
+ * Allocator micro benchmarks.
+ *
+ * Runs against whichever strategy it is linked with:
+ *   cc -O2 -Isrc -DMYALLOC_NO_MAIN bench/bench.c bench/perf_counters.c \
+ *      "src/implicit_free _list.c" -lpthread -o bench_implicit
+ *   cc -O2 -Isrc bench/bench.c bench/perf_counters.c src/fixed_block.c \
+ *      -o bench_fixed
+ *
+ * Every scenario gets a fresh heap and is wrapped in hardware counters
+ * (see perf_counters.h); all figures are per alloc/free call. Counters the
+ * machine does not expose print as "-". Requests a strategy cannot serve
+ * (e.g. more than BLOCK_SIZE bytes from the fixed-block pool) are counted
+ * as failed and skipped.
+ */
+
+#define BENCH_HEAP_SIZE (64 << 20)
+#ifndef BENCH_HEAP_FLAGS // e.g. -DBENCH_HEAP_FLAGS=MYHEAP_MAGAZINES
+#define BENCH_HEAP_FLAGS MYHEAP_NONE
+#endif
+#define LIVE_SLOTS 1024
+
+struct scenario {
+  const char *name;
+  size_t ops; // alloc + free calls
+  size_t (*run)(myHeap *heap, size_t ops); // returns failed allocs
+};
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+// Alloc and free the same size back to back
+static size_t run_same_size(myHeap *heap, size_t ops) {
+  size_t failed = 0;
+  for (size_t i = 0; i < ops / 2; i++) {
+    void *p = myHeapAlloc(heap, 64);
+    if (p == NULL)
+      failed++;
+    myHeapFree(heap, p);
+  }
+  return failed;
+}
+
+// Fill a batch of blocks, then free them all
+static size_t run_fill_drain(myHeap *heap, size_t ops) {
+  static void *blocks[2000];
+  size_t failed = 0;
+  for (size_t round = 0; round < ops / (2 * 2000); round++) {
+    for (int i = 0; i < 2000; i++) {
+      blocks[i] = myHeapAlloc(heap, 48);
+      failed += blocks[i] == NULL;
+    }
+    for (int i = 0; i < 2000; i++)
+      myHeapFree(heap, blocks[i]);
+  }
+  return failed;
+}
+
+// Random frees and allocs over a fixed set of live slots
+static size_t churn(myHeap *heap, size_t ops, size_t minSize,
+                    size_t maxSize) {
+  static void *slots[LIVE_SLOTS];
+  size_t failed = 0;
+  memset(slots, 0, sizeof(slots));
+  for (size_t i = 0; i < ops; i++) {
+    size_t s = next_random() % LIVE_SLOTS;
+    if (slots[s] != NULL) {
+      myHeapFree(heap, slots[s]);
+      slots[s] = NULL;
+    } else {
+      size_t size = minSize + next_random() % (maxSize - minSize + 1);
+      slots[s] = myHeapAlloc(heap, size);
+      failed += slots[s] == NULL;
+    }
+  }
+  for (size_t s = 0; s < LIVE_SLOTS; s++)
+    myHeapFree(heap, slots[s]);
+  return failed;
+}
+
+static size_t run_small_churn(myHeap *heap, size_t ops) {
+  return churn(heap, ops, 8, 64);
+}
+
+static size_t run_mixed_churn(myHeap *heap, size_t ops) {
+  return churn(heap, ops, 16, 1024);
+}
+
+static const struct scenario scenarios[] = {
+    {"same-size", 2000000, run_same_size},
+    {"fill-drain", 400000, run_fill_drain},
+    {"small-churn", 400000, run_small_churn},
+    {"mixed-churn", 400000, run_mixed_churn},
+};
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void) {
+  struct perfCounters pc;
+  perfOpen(&pc);
+
+  printf("%-12s %8s %8s", "scenario", "ops", "ns/op");
+  for (int c = 0; c < PERF_COUNTERS; c++)
+    printf(" %10s", perfCounterNames[c]);
+  printf(" %8s\n", "failed");
+
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    const struct scenario *sc = &scenarios[i];
+    myHeap *heap = myHeapCreate(NULL, BENCH_HEAP_SIZE, BENCH_HEAP_FLAGS);
+    if (heap == NULL) {
+      fprintf(stderr, "%s: cannot create heap\n", sc->name);
+      return 1;
+    }
+
+    struct perfReading r;
+    double start = now_ns();
+    perfStart(&pc);
+    size_t failed = sc->run(heap, sc->ops);
+    perfStop(&pc, &r);
+    double elapsed = now_ns() - start;
+    myHeapDestroy(heap);
+
+    printf("%-12s %8zu %8.1f", sc->name, sc->ops, elapsed / sc->ops);
+    for (int c = 0; c < PERF_COUNTERS; c++) {
+      if (r.valid[c])
+        printf(" %10.2f", (double)r.values[c] / sc->ops);
+      else
+        printf(" %10s", "-");
+    }
+    printf(" %8zu\n", failed);
+  }
+
+  perfClose(&pc);
+  return 0;
+}
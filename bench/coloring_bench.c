@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "heap.h"
+#include "perf_counters.h"
+
+/**
+ * Slab coloring: many small fixed-block pools, a few hot objects in each.
+ *   cc -O2 -Isrc bench/coloring_bench.c bench/perf_counters.c \
+ *      src/fixed_block.c -lpthread -o coloring_bench
+ *
+ * Every pool is its own page-aligned mapping, so without coloring the
+ * first objects of all pools share the same page offsets and thus the same
+ * few cache sets: POOLS * HOT_OBJECTS lines fight over HOT_OBJECTS sets and
+ * keep evicting each other although they would fit in L1 easily. The
+ * benchmark touches the hot objects round robin, with and without
+ * MYHEAP_NO_COLOR, and reports time and L1d/LLC misses per touch.
+ */
+
+#define POOLS 64
+#define HOT_OBJECTS 4
+#define POOL_BYTES (64 * 1024)
+#define ROUNDS 200000
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(const char *name, int flags, struct perfCounters *pc) {
+  myHeap *pools[POOLS];
+  volatile uint64_t *hot[POOLS * HOT_OBJECTS];
+  for (int p = 0; p < POOLS; p++) {
+    pools[p] = myHeapCreate(NULL, POOL_BYTES, flags);
+    for (int i = 0; i < HOT_OBJECTS; i++)
+      hot[i * POOLS + p] = myHeapAlloc(pools[p], 64);
+  }
+
+  // Distinct page offsets among the first objects
+  int offsets[4096 / 64] = {0};
+  int distinct = 0;
+  for (int p = 0; p < POOLS; p++) {
+    int off = ((uintptr_t)hot[p] & 4095) / 64;
+    distinct += !offsets[off];
+    offsets[off] = 1;
+  }
+
+  struct perfReading r;
+  size_t touches = (size_t)ROUNDS * POOLS * HOT_OBJECTS;
+  double start = now_ns();
+  perfStart(pc);
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < POOLS * HOT_OBJECTS; i++)
+      (*hot[i])++;
+  }
+  perfStop(pc, &r);
+  double elapsed = now_ns() - start;
+
+  printf("%-10s %6d %8.2f", name, distinct, elapsed / touches);
+  for (int c = PERF_L1D_MISSES; c <= PERF_LLC_MISSES; c++) {
+    if (r.valid[c])
+      printf(" %10.4f", (double)r.values[c] / touches);
+    else
+      printf(" %10s", "-");
+  }
+  printf("\n");
+
+  for (int p = 0; p < POOLS; p++)
+    myHeapDestroy(pools[p]);
+}
+
+int main(void) {
+  struct perfCounters pc;
+  perfOpen(&pc);
+  printf("%-10s %6s %8s %10s %10s\n", "pools", "colors", "ns/touch",
+         perfCounterNames[PERF_L1D_MISSES], perfCounterNames[PERF_LLC_MISSES]);
+  run("uncolored", MYHEAP_NO_COLOR, &pc);
+  run("colored", MYHEAP_NONE, &pc);
+  perfClose(&pc);
+  return 0;
+}
@@ -0,0 +1,134 @@
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "coro_frame_pool.hpp"
+
+/**
+ * Coroutine creation throughput: frames from the global operator new
+ * versus myheap::FramePool.
+ *   c++ -std=c++20 -O2 -Isrc bench/coro_bench.cpp -pthread -o coro_bench
+ *
+ * Each iteration creates a lazy coroutine, runs it to completion and
+ * destroys it, i.e. one frame allocation and one frame free. Then threads
+ * come and go, one after the other, each running a few coroutines: the
+ * frames of an exited thread must serve the next, not a fresh chunk.
+ *
+ * Last, a producer thread creates coroutines and a consumer thread runs
+ * and destroys them, QUEUED at most in flight. Every frame is freed on the
+ * other thread, yet the chunks mapped stay bounded by the live frames plus
+ * what each thread may hoard.
+ */
+
+#define ITERATIONS 10000000
+#define THREADS 100
+#define HANDOFFS 2000000
+#define QUEUED 256
+
+struct DefaultFrame {};
+
+// A lazy coroutine returning an int; Base picks the frame allocator
+template <class Base> struct Task {
+  struct promise_type : Base {
+    int value = 0;
+    Task get_return_object() {
+      return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_value(int v) { value = v; }
+    void unhandled_exception() {}
+  };
+
+  explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  Task(const Task &) = delete;
+  ~Task() { handle.destroy(); }
+
+  int run() {
+    handle.resume();
+    return handle.promise().value;
+  }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+// Locals that live across a suspension point make the frame realistic
+template <class Base> Task<Base> work(int x) {
+  volatile int scratch[16];
+  for (int i = 0; i < 16; i++)
+    scratch[i] = x + i;
+  co_await std::suspend_never{};
+  co_return scratch[x & 15];
+}
+
+template <class Base> static void run(const char *name) {
+  auto start = std::chrono::steady_clock::now();
+  long sum = 0;
+  for (int i = 0; i < ITERATIONS; i++) {
+    Task<Base> t = work<Base>(i);
+    sum += t.run();
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::printf("%-14s %8.1f ns/coroutine  %10.1f M/s  (sum %ld)\n", name,
+              elapsed.count() / ITERATIONS, ITERATIONS * 1e3 / elapsed.count(),
+              sum);
+}
+
+int main() {
+  run<DefaultFrame>("operator new");
+  run<myheap::PooledFrame>("FramePool");
+
+  std::size_t before = myheap::FramePool::chunks();
+  for (int i = 0; i < THREADS; i++) {
+    std::thread([i] {
+      for (int j = 0; j < 100; j++) {
+        Task<myheap::PooledFrame> t = work<myheap::PooledFrame>(i + j);
+        t.run();
+      }
+    }).join();
+  }
+  std::size_t mapped = myheap::FramePool::chunks() - before;
+  std::printf("%d threads mapped %zu chunks\n", THREADS, mapped);
+  assert(mapped <= 1);
+
+  // Producer/consumer: the producer blocks while the queue is full, the
+  // consumer while it is empty
+  using PooledTask = Task<myheap::PooledFrame>;
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<PooledTask *> queue;
+  before = myheap::FramePool::chunks();
+  std::thread consumer([&] {
+    for (int i = 0; i < HANDOFFS; i++) {
+      std::unique_lock<std::mutex> guard(lock);
+      changed.wait(guard, [&] { return !queue.empty(); });
+      PooledTask *t = queue.front();
+      queue.pop_front();
+      changed.notify_one();
+      guard.unlock();
+      t->run();
+      delete t;
+    }
+  });
+  for (int i = 0; i < HANDOFFS; i++) {
+    PooledTask *t = new PooledTask(work<myheap::PooledFrame>(i));
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [&] { return queue.size() < QUEUED; });
+    queue.push_back(t);
+    changed.notify_one();
+  }
+  consumer.join();
+  mapped = myheap::FramePool::chunks() - before;
+  std::printf("%d frames handed between threads mapped %zu chunks\n",
+              HANDOFFS, mapped);
+  // QUEUED frames, one more on each side, fit one chunk; each thread may
+  // hoard kHoardChunks more, and a released chunk's worth be in transit
+  assert(mapped <= 1 + 2 * myheap::FramePool::kHoardChunks + 1);
+  return 0;
+}
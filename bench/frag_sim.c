@@ -0,0 +1,169 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "heap.h"
+
+/**
+ * Fragmentation over time.
+ *
+ * Simulates hours of server activity against whichever strategy it is
+ * linked with (same build lines as bench.c, plus -lm) and prints a CSV time
+ * series, one row per simulated minute:
+ *   ./frag_implicit implicit 4 > implicit.csv   # label, simulated hours
+ *
+ * Every simulated second a phase-dependent number of objects arrives. Most
+ * are short lived (mean 5 s), a few live for about an hour. The size
+ * distribution shifts every 30 minutes, so space freed by one phase has to
+ * be reused by the next. Columns:
+ *   requested  bytes the simulation asked for and still holds
+ *   live/used  payload of live blocks / bytes carved from the heap
+ *   mapped     size of the heap region, rss the process resident set
+ *   efficiency requested / used, 1.0 means no overhead or fragmentation
+ */
+
+#define HEAP_BYTES ((size_t)256 << 20)
+#define PHASE_SECONDS 1800
+#define SAMPLE_SECONDS 60
+#define SHORT_LIFETIME 5.0  // mean, seconds
+#define LONG_LIFETIME 3600.0
+#define LONG_LIVED_PERCENT 2
+
+struct phase {
+  const char *name;
+  size_t minSize, maxSize; // log-uniform between the two
+  int arrivalsPerSecond;
+};
+
+static const struct phase phases[] = {
+    {"steady-small", 16, 256, 50},
+    {"shift-medium", 256, 4096, 30},
+    {"burst-small", 16, 128, 100},
+    {"mixed", 16, 16384, 40},
+};
+#define PHASES (sizeof(phases) / sizeof(phases[0]))
+
+struct object {
+  long expiry; // simulated second it is freed at
+  void *p;
+  size_t size;
+};
+
+// Binary min-heap of live objects by expiry
+static struct object *live;
+static size_t liveCount, liveCap;
+
+static void push(struct object o) {
+  if (liveCount == liveCap) {
+    size_t cap = liveCap ? 2 * liveCap : 4096;
+    struct object *grown = realloc(live, cap * sizeof(*live));
+    if (grown == NULL) {
+      fprintf(stderr, "frag_sim: cannot track %zu live objects\n", cap);
+      abort();
+    }
+    live = grown;
+    liveCap = cap;
+  }
+  size_t i = liveCount++;
+  while (i > 0 && live[(i - 1) / 2].expiry > o.expiry) {
+    live[i] = live[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  live[i] = o;
+}
+
+static struct object pop(void) {
+  struct object top = live[0];
+  struct object last = live[--liveCount];
+  size_t i = 0;
+  for (;;) {
+    size_t c = 2 * i + 1;
+    if (c >= liveCount)
+      break;
+    if (c + 1 < liveCount && live[c + 1].expiry < live[c].expiry)
+      c++;
+    if (last.expiry <= live[c].expiry)
+      break;
+    live[i] = live[c];
+    i = c;
+  }
+  live[i] = last;
+  return top;
+}
+
+static uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+static double uniform(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return ((rng >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static size_t rss_bytes(void) {
+  long pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f == NULL)
+    return 0;
+  if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+    resident = 0;
+  fclose(f);
+  return (size_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+int main(int argc, char **argv) {
+  const char *label = argc > 1 ? argv[1] : "heap";
+  long hours = argc > 2 ? atol(argv[2]) : 4;
+
+  myHeap *heap = myHeapCreate(NULL, HEAP_BYTES, MYHEAP_NONE);
+  if (heap == NULL)
+    return 1;
+
+  printf("strategy,seconds,phase,objects,requested,live,used,mapped,rss,"
+         "efficiency,failed\n");
+  size_t requested = 0, failed = 0;
+  for (long now = 0; now < hours * 3600; now++) {
+    const struct phase *ph = &phases[(now / PHASE_SECONDS) % PHASES];
+
+    while (liveCount > 0 && live[0].expiry <= now) {
+      struct object o = pop();
+      myHeapFree(heap, o.p);
+      requested -= o.size;
+    }
+
+    for (int i = 0; i < ph->arrivalsPerSecond; i++) {
+      double span = log((double)ph->maxSize / ph->minSize);
+      size_t size = (size_t)(ph->minSize * exp(uniform() * span));
+      int longLived = uniform() * 100 < LONG_LIVED_PERCENT;
+      double mean = longLived ? LONG_LIFETIME : SHORT_LIFETIME;
+      long lifetime = (long)(-log(uniform()) * mean) + 1;
+
+      void *p = myHeapAlloc(heap, size);
+      if (p == NULL) {
+        failed++;
+        continue;
+      }
+      // Touch the payload like a real object would
+      memset(p, 0xab, size);
+      requested += size;
+      push((struct object){now + lifetime, p, size});
+    }
+
+    if (now % SAMPLE_SECONDS == 0) {
+      struct myHeapStats st;
+      myHeapGetStats(heap, &st);
+      printf("%s,%ld,%s,%zu,%zu,%zu,%zu,%zu,%zu,%.3f,%zu\n", label, now,
+             ph->name, liveCount, requested, st.liveBytes, st.usedBytes,
+             st.mappedBytes, rss_bytes(),
+             st.usedBytes ? (double)requested / st.usedBytes : 1.0, failed);
+      fflush(stdout);
+    }
+  }
+
+  myHeapDestroy(heap);
+  free(live);
+  return 0;
+}
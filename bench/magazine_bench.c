@@ -0,0 +1,133 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "heap.h"
+
+/**
+ * Magazines under threads: the fixed-block pool with MYHEAP_MAGAZINES.
+ *   cc -O2 -Isrc bench/magazine_bench.c src/fixed_block.c -lpthread \
+ *      -o magazine_bench
+ *
+ * Each thread allocates a batch of blocks and frees it again, ROUNDS
+ * times, either its own blocks or (handoff) the batch of the thread before
+ * it, so blocks keep moving between magazines and the depot. Reports ns per
+ * alloc/free call. After every run the threads have exited, and with the
+ * depot emptied (myHeapReclaim) every block must be free again.
+ *
+ * Last, threads that still hold magazines of a heap exit after the heap
+ * was destroyed, once with its mapping gone and once with a new heap
+ * likely at the same address: they must drop their magazines, not flush
+ * them into either. Every block of the new heap is then handed out once.
+ */
+
+#define HEAP_BYTES (16 << 20)
+#define MAX_THREADS 4
+#define BATCH 256
+#define ROUNDS 2000
+
+static myHeap *heap;
+static void *batches[MAX_THREADS][BATCH];
+static pthread_barrier_t roundDone;
+static int threadCount, handoff;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *worker(void *arg) {
+  int id = (int)(intptr_t)arg;
+  int from = handoff ? (id + threadCount - 1) % threadCount : id;
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < BATCH; i++)
+      batches[id][i] = myHeapAlloc(heap, 64);
+    // Handoff: wait until the thread before has filled its batch
+    if (handoff)
+      pthread_barrier_wait(&roundDone);
+    for (int i = 0; i < BATCH; i++)
+      myHeapFree(heap, batches[from][i]);
+    if (handoff)
+      pthread_barrier_wait(&roundDone);
+  }
+  return NULL;
+}
+
+static void run(int threads, int crossFree) {
+  heap = myHeapCreate(NULL, HEAP_BYTES, MYHEAP_MAGAZINES);
+  threadCount = threads;
+  handoff = crossFree;
+  pthread_barrier_init(&roundDone, NULL, threads);
+  pthread_t tids[MAX_THREADS];
+  double start = now_ns();
+  for (int t = 0; t < threads; t++)
+    pthread_create(&tids[t], NULL, worker, (void *)(intptr_t)t);
+  for (int t = 0; t < threads; t++)
+    pthread_join(tids[t], NULL);
+  double elapsed = now_ns() - start;
+  pthread_barrier_destroy(&roundDone);
+
+  myHeapReclaim(heap);
+  struct myHeapStats stats;
+  myHeapGetStats(heap, &stats);
+  assert(myHeapCheck(heap) == 0 && stats.liveBlocks == 0);
+  printf("%d thread(s) %-8s %8.1f ns/call\n", threads,
+         crossFree ? "handoff" : "own",
+         elapsed / (2.0 * threads * ROUNDS * BATCH));
+  myHeapDestroy(heap);
+}
+
+static pthread_barrier_t step;
+
+static void *late_exit(void *arg) {
+  (void)arg;
+  // Fill this thread's magazines, then let main destroy the heap
+  void *blocks[BATCH];
+  for (int i = 0; i < BATCH; i++)
+    blocks[i] = myHeapAlloc(heap, 64);
+  for (int i = 0; i < BATCH; i++)
+    myHeapFree(heap, blocks[i]);
+  pthread_barrier_wait(&step);
+  pthread_barrier_wait(&step);
+  return NULL;
+}
+
+// Destroys heap while a thread holds its magazines, creates another heap
+// when reuse is set and then lets the thread exit. Returns the new heap.
+static myHeap *destroy_before_exit(int reuse) {
+  heap = myHeapCreate(NULL, HEAP_BYTES, MYHEAP_MAGAZINES);
+  pthread_barrier_init(&step, NULL, 2);
+  pthread_t tid;
+  pthread_create(&tid, NULL, late_exit, NULL);
+  pthread_barrier_wait(&step);
+  myHeapDestroy(heap);
+  myHeap *next =
+      reuse ? myHeapCreate(NULL, HEAP_BYTES, MYHEAP_MAGAZINES) : NULL;
+  pthread_barrier_wait(&step);
+  pthread_join(tid, NULL);
+  pthread_barrier_destroy(&step);
+  return next;
+}
+
+int main(void) {
+  for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+    run(threads, 0);
+    if (threads > 1)
+      run(threads, 1);
+  }
+
+  destroy_before_exit(0);
+  myHeap *next = destroy_before_exit(1);
+  struct myHeapStats stats;
+  myHeapGetStats(next, &stats);
+  size_t handedOut = 0;
+  while (myHeapAlloc(next, 64) != NULL)
+    handedOut++;
+  assert(myHeapCheck(next) == 0 && handedOut == stats.freeBlocks);
+  printf("threads exiting after their heap was destroyed: ok\n");
+  myHeapDestroy(next);
+  return 0;
+}
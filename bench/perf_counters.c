@@ -0,0 +1,105 @@
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "perf_counters.h"
+
+const char *const perfCounterNames[PERF_COUNTERS] = {
+    "cycles", "instr", "L1d-miss", "LLC-miss", "dTLB-miss", "br-miss"};
+
+#ifdef __linux__
+
+#define CACHE_EVENT(cache, op, result)                                         \
+  ((cache) | ((op) << 8) | ((result) << 16))
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} events[PERF_COUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE,
+     CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                 PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HW_CACHE,
+     CACHE_EVENT(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ,
+                 PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HW_CACHE,
+     CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                 PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+void perfOpen(struct perfCounters *pc) {
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    pc->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+}
+
+void perfClose(struct perfCounters *pc) {
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    if (pc->fds[i] >= 0)
+      close(pc->fds[i]);
+    pc->fds[i] = -1;
+  }
+}
+
+void perfStart(struct perfCounters *pc) {
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    if (pc->fds[i] < 0)
+      continue;
+    ioctl(pc->fds[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(pc->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+void perfStop(struct perfCounters *pc, struct perfReading *out) {
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    if (pc->fds[i] >= 0)
+      ioctl(pc->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+  }
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    // value, time_enabled, time_running
+    uint64_t buf[3];
+    out->valid[i] = pc->fds[i] >= 0 &&
+                    read(pc->fds[i], buf, sizeof(buf)) == sizeof(buf) &&
+                    buf[2] > 0;
+    out->values[i] = 0;
+    if (out->valid[i])
+      out->values[i] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+  }
+}
+
+#else
+
+// No perf_event_open: every counter reads as unavailable
+
+void perfOpen(struct perfCounters *pc) {
+  for (int i = 0; i < PERF_COUNTERS; i++)
+    pc->fds[i] = -1;
+}
+
+void perfClose(struct perfCounters *pc) { (void)pc; }
+
+void perfStart(struct perfCounters *pc) { (void)pc; }
+
+void perfStop(struct perfCounters *pc, struct perfReading *out) {
+  (void)pc;
+  memset(out, 0, sizeof(*out));
+}
+
+#endif
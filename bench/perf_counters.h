@@ -0,0 +1,45 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+
+/**
+ * Hardware counters around a benchmark scenario, via perf_event_open.
+ *
+ * Each counter is opened on its own, so one the CPU (or a VM, or
+ * perf_event_paranoid) does not allow simply reads as unavailable instead
+ * of failing the whole set. When more counters are open than the PMU has
+ * slots, the kernel multiplexes them and the values are scaled by
+ * time_enabled / time_running.
+ */
+
+enum perfCounter {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_DTLB_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_COUNTERS
+};
+
+extern const char *const perfCounterNames[PERF_COUNTERS];
+
+struct perfCounters {
+  int fds[PERF_COUNTERS]; // -1 = unavailable
+};
+
+struct perfReading {
+  uint64_t values[PERF_COUNTERS];
+  int valid[PERF_COUNTERS];
+};
+
+// Opens every counter for the calling thread, disabled
+void perfOpen(struct perfCounters *pc);
+void perfClose(struct perfCounters *pc);
+// Zero and enable all counters
+void perfStart(struct perfCounters *pc);
+// Disable all counters and read them
+void perfStop(struct perfCounters *pc, struct perfReading *out);
+
+#endif
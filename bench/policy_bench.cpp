@@ -0,0 +1,85 @@
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "policy_heap.hpp"
+
+/**
+ * Alloc/free throughput of every myheap::Heap policy combination.
+ *   c++ -std=c++17 -O2 -Isrc bench/policy_bench.cpp -o policy_bench
+ *
+ * Each combination gets a fresh heap and runs the same random sequence of
+ * allocs (16..1024 bytes) and frees over a fixed set of live slots, then
+ * checks the header chain and that requests too large to round up (near
+ * SIZE_MAX) or to fit fail instead of returning a block.
+ */
+
+#define HEAP_BYTES (16 << 20)
+#define OPS 2000000
+#define LIVE_SLOTS 1024
+#define MAX_SIZE 1024
+
+static std::uint64_t rng;
+
+static std::uint64_t next_random() {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+template <class Placement, class Header, class Lock, class Backing>
+static void run(const char *name, Backing backing = Backing()) {
+  static void *slots[LIVE_SLOTS];
+  for (auto &s : slots)
+    s = nullptr;
+  rng = 88172645463325252ULL;
+  myheap::Heap<Placement, Header, Lock, Backing> heap(HEAP_BYTES, backing);
+
+  std::size_t failed = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < OPS; i++) {
+    std::size_t s = next_random() % LIVE_SLOTS;
+    if (slots[s] != nullptr) {
+      heap.deallocate(slots[s]);
+      slots[s] = nullptr;
+    } else {
+      slots[s] = heap.allocate(16 + next_random() % (MAX_SIZE - 16 + 1));
+      failed += slots[s] == nullptr;
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  assert(heap.check());
+  assert(heap.allocate(SIZE_MAX) == nullptr);
+  assert(heap.allocate(SIZE_MAX - 2) == nullptr);
+  assert(heap.allocate(Header::kMaxPayload) == nullptr);
+  assert(heap.allocate(HEAP_BYTES) == nullptr);
+  for (auto &s : slots)
+    heap.deallocate(s);
+  assert(heap.check() && heap.allocate(HEAP_BYTES / 2) != nullptr);
+  std::printf("%-36s %8.1f ns/op  %10zu used bytes  %zu failed\n", name,
+              elapsed.count() / OPS, heap.usedBytes(), failed);
+}
+
+int main() {
+  using namespace myheap;
+  static char buffer[HEAP_BYTES];
+  run<FirstFit, WordHeader, NoLock, MmapBacking>("first-fit word nolock");
+  run<FirstFit, CompactHeader, NoLock, MmapBacking>("first-fit compact nolock");
+  run<SegregatedFit, WordHeader, NoLock, MmapBacking>(
+      "segregated word nolock");
+  run<SegregatedFit, CompactHeader, NoLock, MmapBacking>(
+      "segregated compact nolock");
+  run<SegregatedFit, CompactHeader, SpinLock, MmapBacking>(
+      "segregated compact spin");
+  run<SegregatedFit, CompactHeader, MutexLock, MmapBacking>(
+      "segregated compact mutex");
+  run<FirstFit, WordHeader, MutexLock, BufferBacking>(
+      "first-fit word mutex buffer", BufferBacking(buffer));
+  run<SegregatedFit, CompactHeader, SpinLock, BufferBacking>(
+      "segregated compact spin buffer", BufferBacking(buffer));
+  return 0;
+}
@@ -0,0 +1,211 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heap.h"
+
+/**
+ * Allocator fuzz harness.
+ *
+ * Interprets its input as a sequence of alloc/free/realloc calls and replays
+ * it against the linked strategy while a shadow model (the size and fill
+ * pattern of every live block) checks the results:
+ * - returned blocks are aligned and never overlap another live block
+ * - a block's payload survives every other call, and realloc keeps it
+ * - myHeapCheck finds the heap consistent after every batch of calls
+ * Any failure aborts, so libFuzzer (or a debugger) stops right there.
+ *
+ * libFuzzer, one binary per strategy:
+ *   clang -g -O1 -fsanitize=fuzzer,address -DMYALLOC_LIBFUZZER \
+ *     -DMYALLOC_NO_MAIN -Isrc fuzz/alloc_fuzz.c "src/implicit_free _list.c"
+ *   clang -g -O1 -fsanitize=fuzzer,address -DMYALLOC_LIBFUZZER \
+ *     -Isrc fuzz/alloc_fuzz.c src/fixed_block.c
+ * Standalone, with random inputs from a seed (deterministic):
+ *   cc -g -O1 -DMYALLOC_NO_MAIN -Isrc fuzz/alloc_fuzz.c \
+ *     "src/implicit_free _list.c" -lpthread -o fuzz_implicit
+ *   ./fuzz_implicit [iterations] [seed]
+ *
+ * The first input byte picks the heap's flags from fuzzFlags, so one
+ * binary covers every mode of both strategies (each ignores the other's
+ * flags); the standalone run takes them in turn. -DFUZZ_HEAP_FLAGS=...
+ * pins one combination instead.
+ */
+
+#define FUZZ_HEAP_SIZE (1 << 20)
+#define FUZZ_LARGE_SIZE (128 << 10) // default large_threshold
+#define FUZZ_LARGE_THRESHOLD (16 << 10)
+#define FUZZ_SLOTS 64
+#define FUZZ_ALIGNMENT sizeof(void *)
+#define CHECK_EVERY 16 // calls between full heap walks
+
+struct slot {
+  uint8_t *p; // NULL = empty
+  size_t size;
+  uint8_t seed;
+};
+
+static struct slot slots[FUZZ_SLOTS];
+
+static const int fuzzFlags[] = {
+    MYHEAP_NONE,
+    MYHEAP_ZERO,
+    MYHEAP_OOB_META,
+    MYHEAP_FREE_INDEX,
+    MYHEAP_FAST_BINS,
+    MYHEAP_FAST_BINS | MYHEAP_FREE_INDEX,
+    MYHEAP_OOB_META | MYHEAP_FREE_INDEX | MYHEAP_FAST_BINS | MYHEAP_ZERO,
+    MYHEAP_POPULATE | MYHEAP_ZERO,
+    MYHEAP_PREFAULT | MYHEAP_FAST_BINS,
+    MYHEAP_MAGAZINES,
+    MYHEAP_MAGAZINES | MYHEAP_NO_COLOR | MYHEAP_ZERO,
+};
+#define FUZZ_FLAG_SETS (int)(sizeof(fuzzFlags) / sizeof(fuzzFlags[0]))
+
+#define FAIL(...)                                                              \
+  do {                                                                         \
+    fprintf(stderr, "fuzz: " __VA_ARGS__);                                     \
+    fputc('\n', stderr);                                                       \
+    abort();                                                                   \
+  } while (0)
+
+static uint8_t pattern(uint8_t seed, size_t i) {
+  return (uint8_t)(seed + i * 31);
+}
+
+static void fill(struct slot *s, size_t from) {
+  for (size_t i = from; i < s->size; i++)
+    s->p[i] = pattern(s->seed, i);
+}
+
+static void verify(const struct slot *s, size_t upTo) {
+  for (size_t i = 0; i < upTo; i++) {
+    if (s->p[i] != pattern(s->seed, i))
+      FAIL("block %p corrupted at byte %zu", (void *)s->p, i);
+  }
+}
+
+// A new block must be aligned and must not overlap any other live block
+static void check_new(const struct slot *s) {
+  if ((uintptr_t)s->p % FUZZ_ALIGNMENT != 0)
+    FAIL("block %p misaligned", (void *)s->p);
+  for (int i = 0; i < FUZZ_SLOTS; i++) {
+    const struct slot *o = &slots[i];
+    if (o == s || o->p == NULL)
+      continue;
+    if (s->p < o->p + o->size && o->p < s->p + s->size)
+      FAIL("block %p+%zu overlaps %p+%zu", (void *)s->p, s->size,
+           (void *)o->p, o->size);
+  }
+}
+
+static void check_all(myHeap *heap) {
+  for (int i = 0; i < FUZZ_SLOTS; i++) {
+    if (slots[i].p != NULL)
+      verify(&slots[i], slots[i].size);
+  }
+  if (myHeapCheck(heap) != 0)
+    FAIL("heap inconsistent");
+}
+
+// A flags byte, then 4 bytes per call: op, slot, size (2 bytes, little
+// endian)
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t len) {
+  if (len == 0)
+    return 0;
+#ifdef FUZZ_HEAP_FLAGS // e.g. -DFUZZ_HEAP_FLAGS=MYHEAP_OOB_META
+  int flags = FUZZ_HEAP_FLAGS;
+#else
+  int flags = fuzzFlags[data[0] % FUZZ_FLAG_SETS];
+#endif
+  data++;
+  len--;
+  // Implicit list: the larger sizes become large objects, mapped on their
+  // own (the fixed block strategy has no such tunable)
+  myMallopt(MYMALLOPT_LARGE_THRESHOLD, FUZZ_LARGE_THRESHOLD);
+  myHeap *heap = myHeapCreate(NULL, FUZZ_HEAP_SIZE, flags);
+  if (heap == NULL)
+    FAIL("cannot create heap");
+  memset(slots, 0, sizeof(slots));
+
+  for (size_t n = 0; n + 4 <= len; n += 4) {
+    struct slot *s = &slots[data[n + 1] % FUZZ_SLOTS];
+    // Mostly small sizes, sometimes up to 64 KiB, rarely past the default
+    // large_threshold
+    size_t size = data[n + 2] | (size_t)data[n + 3] << 8;
+    if (!(data[n] & 0x80))
+      size &= 0xff;
+    else if ((data[n] & 0x70) == 0x70)
+      size += FUZZ_LARGE_SIZE;
+
+    switch (data[n] % 3) {
+    case 0: // alloc (the slot's old block, if any, is freed first)
+      if (s->p != NULL) {
+        verify(s, s->size);
+        myHeapFree(heap, s->p);
+        s->p = NULL;
+      }
+      if (size == 0)
+        break;
+      s->p = myHeapAlloc(heap, size);
+      if (s->p == NULL)
+        break; // out of memory or too large for this strategy is fine
+      s->size = size;
+      s->seed = data[n + 1];
+      check_new(s);
+      fill(s, 0);
+      break;
+    case 1: // free
+      if (s->p != NULL)
+        verify(s, s->size);
+      myHeapFree(heap, s->p);
+      s->p = NULL;
+      break;
+    case 2: { // realloc
+      if (s->p == NULL || size == 0)
+        break;
+      uint8_t *q = myHeapRealloc(heap, s->p, size);
+      if (q == NULL)
+        break; // the old block must still be intact
+      size_t kept = s->size < size ? s->size : size;
+      s->p = q;
+      verify(s, kept);
+      s->size = size;
+      check_new(s);
+      fill(s, kept);
+      break;
+    }
+    }
+
+    if ((n / 4) % CHECK_EVERY == 0)
+      check_all(heap);
+  }
+
+  check_all(heap);
+  myHeapDestroy(heap);
+  return 0;
+}
+
+#ifndef MYALLOC_LIBFUZZER
+int main(int argc, char **argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 1000;
+  uint64_t rng = argc > 2 ? strtoull(argv[2], NULL, 0) : 1;
+  static uint8_t input[4096];
+
+  for (long it = 0; it < iterations; it++) {
+    size_t len = 0;
+    // Random lengths too, so short and truncated inputs are covered
+    rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    size_t want = (rng >> 33) % sizeof(input);
+    // Every flag combination in turn
+    input[len++] = (uint8_t)(it % FUZZ_FLAG_SETS);
+    while (len < want) {
+      rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+      input[len++] = rng >> 56;
+    }
+    LLVMFuzzerTestOneInput(input, len);
+  }
+  printf("fuzz: %ld inputs ok\n", iterations);
+  return 0;
+}
+#endif
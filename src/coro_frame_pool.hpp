@@ -0,0 +1,182 @@
+#ifndef CORO_FRAME_POOL_HPP
+#define CORO_FRAME_POOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+
+/**
+ * Coroutine frame allocator (C++20).
+ *
+ * Coroutine frames are short lived and come in a handful of sizes (one per
+ * coroutine function), which is the fixed-block pool's sweet spot. Each
+ * thread keeps one fixed-block pool per 64-byte size bucket, as in
+ * fixed_block.c: memory is grabbed in chunks and split into equal blocks.
+ * Free blocks are linked through their first word instead of a flag scan,
+ * so taking and returning a frame is a couple of loads and stores.
+ *
+ * Opt a coroutine in through its promise type:
+ *
+ *   struct promise_type : myheap::PooledFrame { ... };
+ *
+ * The compiler then calls PooledFrame's operator new/delete with the frame
+ * size. A frame freed on another thread joins that thread's pool, and a
+ * pool holding more than kHoardChunks chunks' worth of free frames of a
+ * size hands one chunk's worth to a shared list. The next pool to run dry
+ * takes up to a chunk's worth from there before it maps a chunk, so frames
+ * a consumer thread frees get back to the producer that allocates them. A
+ * thread's free frames go to the shared list when it exits, too. Frames
+ * larger than kMaxFrame go to the global operator new. Chunks are never
+ * returned to the OS, since their frames may sit in any thread's pool, but
+ * they only grow to the peak number of live frames plus what the threads
+ * may hoard, kHoardChunks chunks per size each.
+ */
+
+namespace myheap {
+
+class FramePool {
+public:
+  static constexpr std::size_t kBucketSize = 64;
+  static constexpr std::size_t kBuckets = 32;
+  static constexpr std::size_t kMaxFrame = kBucketSize * kBuckets;
+  static constexpr std::size_t kChunkSize = 64 * 1024;
+  static constexpr std::size_t kHoardChunks = 2;
+
+  static void *allocate(std::size_t n) {
+    if (n > kMaxFrame)
+      return ::operator new(n);
+    // Every access to a thread_local with a destructor calls its init
+    // function, so take the reference once
+    Pools &pools = pools_;
+    std::size_t bucket = bucketOf(n);
+    if (pools.free[bucket] == nullptr)
+      refill(pools, bucket);
+    Block *b = pools.free[bucket];
+    pools.free[bucket] = b->next;
+    pools.count[bucket]--;
+    return b;
+  }
+
+  static void deallocate(void *p, std::size_t n) noexcept {
+    if (n > kMaxFrame) {
+      ::operator delete(p);
+      return;
+    }
+    Pools &pools = pools_;
+    std::size_t bucket = bucketOf(n);
+    Block *b = static_cast<Block *>(p);
+    b->next = pools.free[bucket];
+    pools.free[bucket] = b;
+    // Compares bytes: dividing for the frames per chunk costs more than
+    // the rest of the free
+    std::size_t held = ++pools.count[bucket] * ((bucket + 1) * kBucketSize);
+    if (held > kHoardChunks * kChunkSize)
+      release(pools, bucket);
+  }
+
+  // Chunks mapped so far, by all threads
+  static std::size_t chunks() {
+    return chunks_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Block {
+    Block *next;
+  };
+
+  struct Pools {
+    Block *free[kBuckets] = {};
+    std::size_t count[kBuckets] = {};
+
+    // Thread exit: hands every free list to the shared one
+    ~Pools() {
+      std::lock_guard<std::mutex> guard(orphanLock_);
+      for (std::size_t i = 0; i < kBuckets; i++) {
+        splice(free[i], orphans_[i], count[i]);
+        count[i] = 0;
+      }
+    }
+  };
+
+  static constexpr std::size_t bucketOf(std::size_t n) {
+    return n == 0 ? 0 : (n - 1) / kBucketSize;
+  }
+
+  // Frames of the bucket's size per chunk
+  static constexpr std::size_t perChunk(std::size_t bucket) {
+    return kChunkSize / ((bucket + 1) * kBucketSize);
+  }
+
+  // Moves up to n frames from the front of from to the front of to and
+  // returns how many it moved
+  static std::size_t splice(Block *&from, Block *&to, std::size_t n) {
+    if (from == nullptr || n == 0)
+      return 0;
+    Block *first = from, *last = from;
+    std::size_t moved = 1;
+    for (; moved < n && last->next != nullptr; moved++)
+      last = last->next;
+    from = last->next;
+    last->next = to;
+    to = first;
+    return moved;
+  }
+
+  // Hands a chunk's worth of this thread's free frames to the shared list
+  static void release(Pools &pools, std::size_t bucket) {
+    std::lock_guard<std::mutex> guard(orphanLock_);
+    pools.count[bucket] -=
+        splice(pools.free[bucket], orphans_[bucket], perChunk(bucket));
+  }
+
+  // Takes up to a chunk's worth of the frames other threads released or
+  // left behind or, when there are none, splits a fresh chunk into blocks
+  // of the bucket's size
+  static void refill(Pools &pools, std::size_t bucket) {
+    {
+      std::lock_guard<std::mutex> guard(orphanLock_);
+      if (orphans_[bucket] != nullptr) {
+        pools.count[bucket] =
+            splice(orphans_[bucket], pools.free[bucket], perChunk(bucket));
+        return;
+      }
+    }
+    void *chunk = mmap(nullptr, kChunkSize, PROT_READ | PROT_WRITE,
+                       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (chunk == MAP_FAILED)
+      throw std::bad_alloc();
+    chunks_.fetch_add(1, std::memory_order_relaxed);
+    std::size_t blockSize = (bucket + 1) * kBucketSize;
+    char *memory = static_cast<char *>(chunk);
+    Block *head = pools.free[bucket];
+    // Link back to front, so the first allocations come from the front
+    for (std::size_t i = perChunk(bucket); i-- > 0;) {
+      Block *b = reinterpret_cast<Block *>(memory + i * blockSize);
+      b->next = head;
+      head = b;
+    }
+    pools.free[bucket] = head;
+    pools.count[bucket] = perChunk(bucket);
+  }
+
+  static thread_local Pools pools_;
+  static inline std::mutex orphanLock_;
+  static inline Block *orphans_[kBuckets] = {};
+  static inline std::atomic<std::size_t> chunks_{0};
+};
+
+inline thread_local FramePool::Pools FramePool::pools_;
+
+// Base for promise types whose frames should come from FramePool
+struct PooledFrame {
+  static void *operator new(std::size_t n) { return FramePool::allocate(n); }
+  static void operator delete(void *p, std::size_t n) noexcept {
+    FramePool::deallocate(p, n);
+  }
+};
+
+} // namespace myheap
+
+#endif
@@ -1,8 +1,20 @@
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "heap.h"
+#include "heap_config.h"
+#include "probes.h"
 
 #define BLOCK_SIZE 64 // in bytes
-#define BLOCK_COUNT 1024
+#define BLOCK_COUNT 1024 // default heap only, other pools size themselves
+#define HEAP_SIZE_MAX ((size_t)1 << (sizeof(void *) >= 8 ? 40 : 30))
+#define CACHE_LINE 64
+#define MAX_COLORS (4096 / CACHE_LINE) // one page worth of offsets
 
 /**
  * Plan:
@@ -14,26 +26,786 @@
  * - if no free blocks, out of memory
  * - when freeing, find the idx of the block in the memory pool
  * - set it to free.
+ *
+ * Every pool is a heap instance. A heap created with myHeapCreate keeps
+ * its bookkeeping at the front of its own region:
+ *
+ * | struct myHeap | bitmap | free_list[blockCount] | pad | block 0 | ...
+ *                                                        ^ memory
+ *
+ * The default heap behind myAlloc/myFree uses the static arrays below,
+ * unless the heap_size tunable asks for a pool of another size.
+ *
+ * Slab coloring: pools mapped at page boundaries would all start their
+ * blocks at the same page offset, so block 0 of every pool competes for
+ * the same L1/L2 cache sets. Each new pool therefore shifts its first block
+ * by a rotating number of cache lines (its color). Up to a page (but at
+ * most 1/16 of the pool) is set aside for the offsets.
+ *
+ * Finding a free block: a flat scan of free_list is O(blockCount), which
+ * hurts once a pool of millions of blocks fills up. An occupancy bitmap
+ * sits on top of it instead: one bit per block in the leaf level (1 = in
+ * use) and, in every level above, one bit per word of the level below
+ * (1 = that word is all ones). Alloc descends from the single top word
+ * with one count-trailing-zeros per level, free climbs back up only while
+ * a full word stops being full: O(log64 n) either way, with 5 levels
+ * covering up to 2^30 blocks. Bits past the last block are kept set, so
+ * they never look free.
+ *
+ * Object caching (myHeapSetObjectCache): free_list gets a third state.
+ * A block handed out for the first time is constructed; freeing it marks
+ * it BLOCK_CACHED instead of BLOCK_FREE, so the next alloc returns it as
+ * it is. Only myHeapReclaim runs the destructor, turning cached blocks
+ * back into free ones. When the pool runs dry, the owner's reclaim hook
+ * gets one chance to free objects before the alloc fails.
+ */
+#define BLOCK_FREE 0
+#define BLOCK_USED 1
+#define BLOCK_CACHED 2 // free, but still constructed
+
+#define BITMAP_LEVELS 5
+#define MAX_BLOCKS ((size_t)1 << (6 * BITMAP_LEVELS))
+
+/**
+ * Magazines (MYHEAP_MAGAZINES, after Bonwick's magazine layer):
+ * - every thread keeps a loaded and a previous magazine per heap, each a
+ * stack of up to magazine_size (at most MAGAZINE_SIZE) free blocks
+ * - alloc pops from the loaded magazine and free pushes onto it; when it
+ * runs empty (full), a full (empty) previous magazine is swapped in
+ * - only when both are exhausted does the thread take the heap lock, to
+ * trade a magazine with the heap's depot of full and empty magazines, or
+ * to fall back to the pool itself
+ * So at most 2 * magazine_size blocks sit in any thread's cache, and the
+ * common case is a few instructions without locks or atomics. Blocks held
+ * by magazines count as in use in the pool and its stats; myHeapReport
+ * counts those in the depot and the caller's magazines as free.
  */
+#define MAGAZINE_SIZE 32
+#define THREAD_CACHES 4 // heaps with magazines per thread
+
+struct magazine {
+  struct magazine *next; // depot list link
+  int rounds;            // blocks held
+  void *objs[MAGAZINE_SIZE];
+};
+
+struct myHeap {
+  uint8_t *memory;    // first block
+  uint8_t *free_list; // BLOCK_FREE, BLOCK_USED or BLOCK_CACHED
+  size_t blockCount;
+  uint64_t *bits[BITMAP_LEVELS]; // occupancy, bits[0] = one bit per block
+  int levels;
+  void *mapStart; // region to munmap on destroy, NULL if not ours
+  size_t mapSize;
+  int flags;
+  // MYHEAP_MAGAZINES only
+  uint64_t id; // tells a new heap from a destroyed one at the same address
+  myHeap *nextLive, *prevLive; // liveHeaps links
+  int magazineRounds; // blocks a full magazine holds
+  pthread_mutex_t lock; // guards the pool and the depot
+  struct magazine *fullMags;
+  struct magazine *emptyMags;
+  // Object caching only
+  myHeapCtor ctor;
+  myHeapDtor dtor;
+  myHeapReclaimHook reclaim;
+  void *cacheArg;
+};
+
+struct threadCache {
+  myHeap *heap;
+  uint64_t heapId;
+  struct magazine *loaded;
+  struct magazine *previous;
+};
+
+_Static_assert(BLOCK_COUNT % 64 == 0 && BLOCK_COUNT > 64 &&
+                   BLOCK_COUNT < 64 * 64,
+               "the default heap's bitmap has exactly two levels");
 
 static uint8_t memory[BLOCK_SIZE * BLOCK_COUNT];
-static int free_list[BLOCK_COUNT];
+static uint8_t free_list[BLOCK_COUNT];
+static uint64_t leafBits[BLOCK_COUNT / 64];
+static uint64_t topBits[1] = {~0ULL << (BLOCK_COUNT / 64)};
+static myHeap defaultHeap = {.memory = memory,
+                             .free_list = free_list,
+                             .blockCount = BLOCK_COUNT,
+                             .bits = {leafBits, topBits},
+                             .levels = 2,
+                             .mapSize = sizeof(memory),
+                             .magazineRounds = MAGAZINE_SIZE,
+                             .lock = PTHREAD_MUTEX_INITIALIZER};
 
-void *myAlloc() {
-  for (int i = 0; i < BLOCK_COUNT; i++) {
-    if (!free_list[i]) {
-      free_list[i] = 1;
-      return memory + i + BLOCK_SIZE;
-    }
+static __thread struct threadCache threadCaches[THREAD_CACHES];
+static uint64_t nextHeapId = 1;
+static size_t nextColor;
+static pthread_key_t cacheKey;
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+// Magazine heaps not destroyed yet. A thread that exits flushes its
+// magazines only into these; liveLock is held across the flush, so the
+// heap cannot be destroyed in the middle of it.
+static myHeap *liveHeaps;
+static pthread_mutex_t liveLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Built-in defaults and limits of the tunables (see heap_config.h)
+static struct heapTunable tunables[MYMALLOPT_PARAMS] = {
+    [MYMALLOPT_HEAP_SIZE] = {sizeof(memory), 4096, HEAP_SIZE_MAX},
+    [MYMALLOPT_MAGAZINE_SIZE] = {MAGAZINE_SIZE, 1, MAGAZINE_SIZE},
+};
+static pthread_once_t tunablesOnce = PTHREAD_ONCE_INIT;
+
+static void tunables_load(void) {
+  config_parse(tunables, getenv("MYALLOC_CONF"));
+}
+
+static size_t tunable(int param) {
+  pthread_once(&tunablesOnce, tunables_load);
+  return __atomic_load_n(&tunables[param].value, __ATOMIC_RELAXED);
+}
+
+int myMallopt(int param, size_t value) {
+  pthread_once(&tunablesOnce, tunables_load);
+  return config_set(tunables, param, value);
+}
+
+// Backs myAlloc/myFree: the static pool above, or a mapped one when
+// heap_size differs from it
+static myHeap *mainHeap;
+static pthread_once_t mainHeapOnce = PTHREAD_ONCE_INIT;
+
+static void main_heap_init(void) {
+  size_t size = tunable(MYMALLOPT_HEAP_SIZE);
+  if (size != sizeof(memory))
+    mainHeap = myHeapCreate(NULL, size, MYHEAP_NONE);
+  if (mainHeap == NULL)
+    mainHeap = &defaultHeap;
+}
+
+static myHeap *main_heap(void) {
+  pthread_once(&mainHeapOnce, main_heap_init);
+  return mainHeap;
+}
+
+// Bitmap words for count blocks over all levels; *levels gets the depth
+static size_t bitmap_words(size_t count, int *levels) {
+  size_t words = 0;
+  size_t n = count;
+  int l = 0;
+  do {
+    n = (n + 63) / 64;
+    words += n;
+    l++;
+  } while (n > 1);
+  *levels = l;
+  return words;
+}
+
+// Points the levels into words and marks the bits past the end of each
+// level as in use; every other bit must already be 0
+static void bitmap_init(myHeap *heap, uint64_t *words) {
+  size_t n = heap->blockCount;
+  for (int l = 0; l < heap->levels; l++) {
+    heap->bits[l] = words;
+    size_t wordCount = (n + 63) / 64;
+    if (n % 64)
+      words[wordCount - 1] |= ~0ULL << (n % 64);
+    words += wordCount;
+    n = wordCount;
+  }
+}
+
+// Index of the lowest free block, or blockCount when all are in use
+static size_t bitmap_find(myHeap *heap) {
+  size_t i = 0;
+  for (int l = heap->levels - 1; l >= 0; l--) {
+    uint64_t avail = ~heap->bits[l][i];
+    if (avail == 0)
+      return heap->blockCount;
+    i = i * 64 + __builtin_ctzll(avail);
   }
-  // Out of memory
+  return i;
+}
+
+static void bitmap_set(myHeap *heap, size_t i) {
+  for (int l = 0; l < heap->levels; l++, i /= 64) {
+    uint64_t *word = &heap->bits[l][i / 64];
+    *word |= 1ULL << (i % 64);
+    if (*word != ~0ULL)
+      break; // the parent still sees a free bit below
+  }
+}
+
+static void bitmap_clear(myHeap *heap, size_t i) {
+  for (int l = 0; l < heap->levels; l++, i /= 64) {
+    uint64_t *word = &heap->bits[l][i / 64];
+    int wasFull = *word == ~0ULL;
+    *word &= ~(1ULL << (i % 64));
+    if (!wasFull)
+      break;
+  }
+}
+
+myHeap *myHeapCreate(void *buffer, size_t size, int flags) {
+  void *mapStart = NULL;
+
+  if (buffer == NULL) {
+    buffer = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (buffer == MAP_FAILED)
+      return NULL;
+    mapStart = buffer;
+  }
+
+  // Round the bookkeeping up so the heap struct and the bitmap are word
+  // aligned
+  uintptr_t start = ((uintptr_t)buffer + sizeof(uint64_t) - 1) &
+                    ~(uintptr_t)(sizeof(uint64_t) - 1);
+  uintptr_t end = (uintptr_t)buffer + size;
+  uintptr_t bits_start = start + sizeof(myHeap);
+  if (bits_start >= end)
+    goto too_small;
+
+  // Each block costs BLOCK_SIZE bytes of memory, one free_list byte and a
+  // bit per bitmap level (a bit over 1/8 byte); BLOCK_SIZE - 1 more bytes
+  // may be lost to aligning the first block, and up to a word per level to
+  // rounding the bitmap.
+  size_t avail = end - bits_start;
+  // Colors are whole lines that are also whole blocks, so blocks stay
+  // BLOCK_SIZE aligned
+  size_t step = BLOCK_SIZE > CACHE_LINE ? BLOCK_SIZE : CACHE_LINE;
+  size_t reserve = 0;
+  if (!(flags & MYHEAP_NO_COLOR)) {
+    reserve = (MAX_COLORS - 1) * step;
+    if (reserve > avail / 16)
+      reserve = avail / 16;
+  }
+  size_t fixed = (BLOCK_SIZE - 1) + reserve + BITMAP_LEVELS * sizeof(uint64_t);
+  if (avail <= fixed)
+    goto too_small;
+  // Per 512 blocks: 64 leaf bytes, one byte in the level above
+  size_t count = (avail - fixed) * 512 / (512 * (BLOCK_SIZE + 1) + 64 + 1);
+  if (count > MAX_BLOCKS)
+    count = MAX_BLOCKS;
+  if (count == 0)
+    goto too_small;
+  int levels;
+  size_t words = bitmap_words(count, &levels);
+
+  myHeap *heap = (myHeap *)start;
+  uintptr_t flags_start = bits_start + words * sizeof(uint64_t);
+  heap->free_list = (uint8_t *)flags_start;
+  heap->memory = (uint8_t *)((flags_start + count + BLOCK_SIZE - 1) &
+                             ~(uintptr_t)(BLOCK_SIZE - 1));
+  if (!(flags & MYHEAP_NO_COLOR)) {
+    size_t slack = end - (uintptr_t)(heap->memory + count * BLOCK_SIZE);
+    size_t colors = slack / step + 1;
+    if (colors > MAX_COLORS)
+      colors = MAX_COLORS;
+    size_t color =
+        __atomic_fetch_add(&nextColor, 1, __ATOMIC_RELAXED) % colors;
+    heap->memory += color * step;
+  }
+  heap->blockCount = count;
+  heap->levels = levels;
+  heap->mapStart = mapStart;
+  heap->mapSize = size;
+  heap->flags = flags;
+  heap->id = __atomic_fetch_add(&nextHeapId, 1, __ATOMIC_RELAXED);
+  heap->magazineRounds = tunable(MYMALLOPT_MAGAZINE_SIZE);
+  pthread_mutex_init(&heap->lock, NULL);
+  heap->fullMags = NULL;
+  heap->emptyMags = NULL;
+  heap->ctor = NULL;
+  heap->dtor = NULL;
+  heap->reclaim = NULL;
+  heap->cacheArg = NULL;
+  // A fresh anonymous mapping is already zeroed
+  if (mapStart == NULL) {
+    memset((void *)bits_start, 0, words * sizeof(uint64_t));
+    memset(heap->free_list, 0, count);
+  }
+  bitmap_init(heap, (uint64_t *)bits_start);
+  if (flags & MYHEAP_MAGAZINES) {
+    pthread_mutex_lock(&liveLock);
+    heap->prevLive = NULL;
+    heap->nextLive = liveHeaps;
+    if (liveHeaps != NULL)
+      liveHeaps->prevLive = heap;
+    liveHeaps = heap;
+    pthread_mutex_unlock(&liveLock);
+  }
+  HEAP_PROBE2(init, heap, size);
+  return heap;
+
+too_small:
+  if (mapStart)
+    munmap(mapStart, size);
   return NULL;
 }
 
-void myFree(void *p) {
+static void *pool_alloc(myHeap *heap) {
+  size_t i = bitmap_find(heap);
+  if (i == heap->blockCount)
+    return NULL;
+  uint8_t *block = heap->memory + i * BLOCK_SIZE;
+  if (heap->free_list[i] == BLOCK_FREE && heap->ctor != NULL &&
+      heap->ctor(block, heap->cacheArg) != 0)
+    return NULL;
+  heap->free_list[i] = BLOCK_USED;
+  bitmap_set(heap, i);
+  return block;
+}
+
+static void pool_free(myHeap *heap, void *p) {
   // memory  ---> start address of our pool
   // p       ---> somewhere inside the pool
   // (p - memory) gives positive number of bytes between start and p
-  int idx = ((uint8_t *)p - memory) / BLOCK_SIZE;
-  free_list[idx] = 0;
-}
\ No newline at end of file
+  size_t idx = ((uint8_t *)p - heap->memory) / BLOCK_SIZE;
+  heap->free_list[idx] = heap->ctor != NULL ? BLOCK_CACHED : BLOCK_FREE;
+  bitmap_clear(heap, idx);
+}
+
+// Call with heap->lock held
+static struct magazine *depot_empty_magazine(myHeap *heap) {
+  struct magazine *m = heap->emptyMags;
+  if (m != NULL) {
+    heap->emptyMags = m->next;
+    return m;
+  }
+  return calloc(1, sizeof(struct magazine));
+}
+
+// Returns a thread's magazines to the heap: full ones to the depot, the
+// rounds of partial ones to the pool
+static void cache_flush(struct threadCache *c) {
+  myHeap *heap = c->heap;
+  struct magazine *mags[2] = {c->loaded, c->previous};
+
+  pthread_mutex_lock(&heap->lock);
+  for (int i = 0; i < 2; i++) {
+    struct magazine *m = mags[i];
+    if (m == NULL)
+      continue;
+    if (m->rounds == heap->magazineRounds) {
+      m->next = heap->fullMags;
+      heap->fullMags = m;
+      continue;
+    }
+    while (m->rounds > 0)
+      pool_free(heap, m->objs[--m->rounds]);
+    m->next = heap->emptyMags;
+    heap->emptyMags = m;
+  }
+  pthread_mutex_unlock(&heap->lock);
+  memset(c, 0, sizeof(*c));
+}
+
+static void cache_thread_exit(void *caches) {
+  struct threadCache *c = (struct threadCache *)caches;
+  pthread_mutex_lock(&liveLock);
+  for (int i = 0; i < THREAD_CACHES; i++) {
+    if (c[i].heap == NULL)
+      continue;
+    myHeap *heap = liveHeaps;
+    while (heap != NULL && (heap != c[i].heap || heap->id != c[i].heapId))
+      heap = heap->nextLive;
+    if (heap != NULL) {
+      cache_flush(&c[i]);
+    } else {
+      // The heap is gone, and its blocks with it
+      free(c[i].loaded);
+      free(c[i].previous);
+      memset(&c[i], 0, sizeof(c[i]));
+    }
+  }
+  pthread_mutex_unlock(&liveLock);
+}
+
+static void cache_key_init(void) {
+  pthread_key_create(&cacheKey, cache_thread_exit);
+}
+
+// The calling thread's magazines for heap, NULL when all slots are taken
+static struct threadCache *thread_cache(myHeap *heap) {
+  struct threadCache *free_slot = NULL;
+  for (int i = 0; i < THREAD_CACHES; i++) {
+    struct threadCache *c = &threadCaches[i];
+    if (c->heap == heap && c->heapId == heap->id)
+      return c;
+    if (c->heap == heap) {
+      // Left over from a destroyed heap at the same address
+      free(c->loaded);
+      free(c->previous);
+      memset(c, 0, sizeof(*c));
+    }
+    if (c->heap == NULL && free_slot == NULL)
+      free_slot = c;
+  }
+  if (free_slot == NULL)
+    return NULL;
+
+  pthread_once(&cacheKeyOnce, cache_key_init);
+  pthread_setspecific(cacheKey, threadCaches);
+  pthread_mutex_lock(&heap->lock);
+  free_slot->loaded = depot_empty_magazine(heap);
+  free_slot->previous = depot_empty_magazine(heap);
+  pthread_mutex_unlock(&heap->lock);
+  if (free_slot->loaded == NULL || free_slot->previous == NULL) {
+    free(free_slot->loaded);
+    free(free_slot->previous);
+    memset(free_slot, 0, sizeof(*free_slot));
+    return NULL;
+  }
+  free_slot->heap = heap;
+  free_slot->heapId = heap->id;
+  return free_slot;
+}
+
+// Empties the depot's full magazines into the pool. Call with heap->lock
+// held.
+static void depot_flush(myHeap *heap) {
+  while (heap->fullMags != NULL) {
+    struct magazine *m = heap->fullMags;
+    heap->fullMags = m->next;
+    while (m->rounds > 0)
+      pool_free(heap, m->objs[--m->rounds]);
+    m->next = heap->emptyMags;
+    heap->emptyMags = m;
+  }
+}
+
+static void *magazine_alloc(myHeap *heap) {
+  struct threadCache *c = thread_cache(heap);
+  if (c != NULL) {
+    if (c->loaded->rounds > 0)
+      return c->loaded->objs[--c->loaded->rounds];
+    if (c->previous->rounds > 0) {
+      struct magazine *m = c->loaded;
+      c->loaded = c->previous;
+      c->previous = m;
+      return c->loaded->objs[--c->loaded->rounds];
+    }
+  }
+
+  pthread_mutex_lock(&heap->lock);
+  if (c != NULL && heap->fullMags != NULL) {
+    // Both magazines are empty: trade one for a full one from the depot
+    struct magazine *full = heap->fullMags;
+    heap->fullMags = full->next;
+    c->previous->next = heap->emptyMags;
+    heap->emptyMags = c->previous;
+    c->previous = c->loaded;
+    c->loaded = full;
+    pthread_mutex_unlock(&heap->lock);
+    return c->loaded->objs[--c->loaded->rounds];
+  }
+  void *p = pool_alloc(heap);
+  if (p == NULL && heap->fullMags != NULL) {
+    // A thread without a cache slot cannot take a magazine, but the pool
+    // must not run dry while the depot holds free blocks
+    depot_flush(heap);
+    p = pool_alloc(heap);
+  }
+  pthread_mutex_unlock(&heap->lock);
+  return p;
+}
+
+static void magazine_free(myHeap *heap, void *p) {
+  struct threadCache *c = thread_cache(heap);
+  if (c != NULL) {
+    if (c->loaded->rounds < heap->magazineRounds) {
+      c->loaded->objs[c->loaded->rounds++] = p;
+      return;
+    }
+    if (c->previous->rounds == 0) {
+      struct magazine *m = c->loaded;
+      c->loaded = c->previous;
+      c->previous = m;
+      c->loaded->objs[c->loaded->rounds++] = p;
+      return;
+    }
+  }
+
+  pthread_mutex_lock(&heap->lock);
+  struct magazine *empty = c != NULL ? depot_empty_magazine(heap) : NULL;
+  if (empty != NULL) {
+    // Both magazines are full: park one in the depot, start an empty one
+    c->previous->next = heap->fullMags;
+    heap->fullMags = c->previous;
+    c->previous = c->loaded;
+    c->loaded = empty;
+    pthread_mutex_unlock(&heap->lock);
+    c->loaded->objs[c->loaded->rounds++] = p;
+    return;
+  }
+  pool_free(heap, p);
+  pthread_mutex_unlock(&heap->lock);
+}
+
+void *myHeapAlloc(myHeap *heap, size_t size) {
+  // Every block has the same size, larger requests cannot be served
+  if (size > BLOCK_SIZE)
+    return NULL;
+
+  uint8_t *block = (heap->flags & MYHEAP_MAGAZINES) ? magazine_alloc(heap)
+                                                    : pool_alloc(heap);
+  if (block == NULL && heap->reclaim != NULL) {
+    // Called without locks held: the hook frees through myHeapFree
+    heap->reclaim(heap->cacheArg);
+    block = (heap->flags & MYHEAP_MAGAZINES) ? magazine_alloc(heap)
+                                             : pool_alloc(heap);
+  }
+  if (block == NULL) {
+    // Out of memory
+    HEAP_PROBE2(oom, heap, size);
+    return NULL;
+  }
+  // Zeroing would wipe a cached object's constructed state
+  if ((heap->flags & MYHEAP_ZERO) && heap->ctor == NULL)
+    memset(block, 0, BLOCK_SIZE);
+  return block;
+}
+
+void myHeapFree(myHeap *heap, void *p) {
+  if (p == NULL)
+    return;
+  if (heap->flags & MYHEAP_MAGAZINES)
+    magazine_free(heap, p);
+  else
+    pool_free(heap, p);
+}
+
+void myHeapFlushCache(myHeap *heap) {
+  for (int i = 0; i < THREAD_CACHES; i++) {
+    if (threadCaches[i].heap == heap && threadCaches[i].heapId == heap->id)
+      cache_flush(&threadCaches[i]);
+  }
+}
+
+int myHeapSetObjectCache(myHeap *heap, myHeapCtor ctor, myHeapDtor dtor,
+                         myHeapReclaimHook reclaim, void *arg) {
+  // Blocks handed out so far were never constructed
+  for (size_t i = 0; i < heap->blockCount; i++) {
+    if (heap->free_list[i] != BLOCK_FREE)
+      return -1;
+  }
+  heap->ctor = ctor;
+  heap->dtor = dtor;
+  heap->reclaim = reclaim;
+  heap->cacheArg = arg;
+  return 0;
+}
+
+// Gives whole pages inside a run of free blocks back to the OS, returns
+// their bytes
+static size_t release_pages(uint8_t *start, uint8_t *end) {
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t from = ((uintptr_t)start + page - 1) & ~(page - 1);
+  uintptr_t to = (uintptr_t)end & ~(page - 1);
+  if (from >= to)
+    return 0;
+  madvise((void *)from, to - from, MADV_DONTNEED);
+  return to - from;
+}
+
+size_t myHeapReclaim(myHeap *heap) {
+  // Objects in magazines count as in use: empty this thread's magazines
+  // and the depot into the pool first. Other threads keep theirs.
+  myHeapFlushCache(heap);
+
+  pthread_mutex_lock(&heap->lock);
+  depot_flush(heap);
+  size_t reclaimed = 0, released = 0;
+  size_t runStart = 0;
+  for (size_t i = 0; i <= heap->blockCount; i++) {
+    if (i < heap->blockCount && heap->free_list[i] != BLOCK_USED) {
+      if (heap->free_list[i] == BLOCK_CACHED) {
+        if (heap->dtor != NULL)
+          heap->dtor(heap->memory + i * BLOCK_SIZE, heap->cacheArg);
+        heap->free_list[i] = BLOCK_FREE;
+        reclaimed++;
+      }
+      continue;
+    }
+    // End of a run of free blocks. Only our own mapping may be dropped: a
+    // caller's buffer need not be anonymous memory.
+    if (heap->mapStart != NULL && runStart < i)
+      released += release_pages(heap->memory + runStart * BLOCK_SIZE,
+                                heap->memory + i * BLOCK_SIZE);
+    runStart = i + 1;
+  }
+  pthread_mutex_unlock(&heap->lock);
+  HEAP_PROBE2(purge, heap, released);
+  return reclaimed;
+}
+
+void *myHeapRealloc(myHeap *heap, void *p, size_t size) {
+  if (p == NULL)
+    return myHeapAlloc(heap, size);
+  if (size == 0) {
+    myHeapFree(heap, p);
+    return NULL;
+  }
+  // Every block already holds BLOCK_SIZE bytes, and none holds more
+  return size <= BLOCK_SIZE ? p : NULL;
+}
+
+void myHeapGetStats(myHeap *heap, struct myHeapStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->mappedBytes = heap->mapSize;
+  // Blocks are handed out lowest index first, so everything up to the
+  // last live block counts as used, like heapStart..heapEnd in the
+  // implicit list
+  for (size_t i = 0; i < heap->blockCount; i++) {
+    if (heap->free_list[i] == BLOCK_USED) {
+      stats->liveBlocks++;
+      stats->usedBytes = (i + 1) * BLOCK_SIZE;
+    }
+  }
+  stats->freeBlocks = heap->blockCount - stats->liveBlocks;
+  stats->liveBytes = stats->liveBlocks * BLOCK_SIZE;
+  stats->freeBytes = stats->freeBlocks * BLOCK_SIZE;
+}
+
+int myHeapCheck(myHeap *heap) {
+  if ((uintptr_t)heap->memory % BLOCK_SIZE != 0) {
+    fprintf(stderr, "Heap check failed: pool %p not block aligned\n",
+            (void *)heap->memory);
+    return -1;
+  }
+  if (heap->mapStart != NULL &&
+      heap->memory + heap->blockCount * BLOCK_SIZE >
+          (uint8_t *)heap->mapStart + heap->mapSize) {
+    fprintf(stderr, "Heap check failed: pool overruns its mapping\n");
+    return -1;
+  }
+  for (size_t i = 0; i < heap->blockCount; i++) {
+    if (heap->free_list[i] > BLOCK_CACHED ||
+        (heap->free_list[i] == BLOCK_CACHED && heap->ctor == NULL)) {
+      fprintf(stderr, "Heap check failed: block %zu has state %d\n", i,
+              heap->free_list[i]);
+      return -1;
+    }
+    int used = heap->bits[0][i / 64] >> (i % 64) & 1;
+    if (used != (heap->free_list[i] == BLOCK_USED)) {
+      fprintf(stderr, "Heap check failed: bitmap says block %zu is %s\n", i,
+              used ? "used" : "free");
+      return -1;
+    }
+  }
+  // Every summary bit tells whether its word one level down is full
+  size_t n = (heap->blockCount + 63) / 64;
+  for (int l = 1; l < heap->levels; l++) {
+    for (size_t w = 0; w < n; w++) {
+      int full = heap->bits[l][w / 64] >> (w % 64) & 1;
+      if (full != (heap->bits[l - 1][w] == ~0ULL)) {
+        fprintf(stderr, "Heap check failed: level %d word %zu marked %s\n",
+                l - 1, w, full ? "full" : "not full");
+        return -1;
+      }
+    }
+    n = (n + 63) / 64;
+  }
+  return 0;
+}
+
+// Blocks parked in the depot and in the calling thread's magazines. Other
+// threads' magazines are out of reach: at most 2 * magazine_size each.
+static size_t magazine_rounds(myHeap *heap) {
+  size_t rounds = 0;
+  for (int i = 0; i < THREAD_CACHES; i++) {
+    struct threadCache *c = &threadCaches[i];
+    if (c->heap == heap && c->heapId == heap->id)
+      rounds += c->loaded->rounds + c->previous->rounds;
+  }
+  pthread_mutex_lock(&heap->lock);
+  for (struct magazine *m = heap->fullMags; m != NULL; m = m->next)
+    rounds += m->rounds;
+  pthread_mutex_unlock(&heap->lock);
+  return rounds;
+}
+
+void myHeapReport(myHeap *heap, FILE *out) {
+  if (heap == NULL)
+    heap = main_heap();
+
+  struct myHeapStats stats;
+  myHeapGetStats(heap, &stats);
+  // The stats count blocks in magazines as in use; to the owner they are
+  // free
+  size_t cachedMags = 0;
+  if (heap->flags & MYHEAP_MAGAZINES) {
+    cachedMags = magazine_rounds(heap);
+    if (cachedMags > stats.liveBlocks)
+      cachedMags = stats.liveBlocks; // another thread moved blocks meanwhile
+    stats.liveBlocks -= cachedMags;
+    stats.freeBlocks += cachedMags;
+  }
+  // One size class: every block is BLOCK_SIZE bytes
+  fprintf(out, "heap report for %p\n", (void *)heap);
+  fprintf(out, "  mapped %zu, %zu blocks of %d bytes\n", stats.mappedBytes,
+          heap->blockCount, BLOCK_SIZE);
+  fprintf(out, "  live %zu blocks (%zu bytes), free %zu blocks (%zu bytes)\n",
+          stats.liveBlocks, stats.liveBlocks * BLOCK_SIZE, stats.freeBlocks,
+          stats.freeBlocks * BLOCK_SIZE);
+  if (heap->flags & MYHEAP_MAGAZINES)
+    fprintf(out,
+            "  magazines hold %zu free blocks (this thread and the depot, "
+            "counted as free above)\n",
+            cachedMags);
+  if (heap->ctor != NULL) {
+    size_t cached = 0;
+    for (size_t i = 0; i < heap->blockCount; i++)
+      cached += heap->free_list[i] == BLOCK_CACHED;
+    fprintf(out, "  %zu free blocks hold constructed objects\n", cached);
+  }
+}
+
+static myHeap *reportHeap; // NULL: the default heap
+static int reportRegistered;
+
+static void report_at_exit(void) { myHeapReport(reportHeap, stderr); }
+
+void myHeapReportAtExit(myHeap *heap) {
+  reportHeap = heap;
+  if (!reportRegistered)
+    atexit(report_at_exit);
+  reportRegistered = 1;
+}
+
+void myHeapDestroy(myHeap *heap) {
+  if (heap == NULL)
+    return;
+  // Threads that exit from now on drop their magazines of this heap
+  if (heap->flags & MYHEAP_MAGAZINES) {
+    pthread_mutex_lock(&liveLock);
+    if (heap->prevLive != NULL)
+      heap->prevLive->nextLive = heap->nextLive;
+    else
+      liveHeaps = heap->nextLive;
+    if (heap->nextLive != NULL)
+      heap->nextLive->prevLive = heap->prevLive;
+    pthread_mutex_unlock(&liveLock);
+  }
+  // Magazines live outside the region. Other threads that cached blocks of
+  // this heap must have exited, called myHeapFlushCache or at least stopped
+  // using the heap by now: their magazines are freed when they exit.
+  myHeapFlushCache(heap);
+  struct magazine *lists[2] = {heap->fullMags, heap->emptyMags};
+  for (int i = 0; i < 2; i++) {
+    while (lists[i] != NULL) {
+      struct magazine *next = lists[i]->next;
+      free(lists[i]);
+      lists[i] = next;
+    }
+  }
+  pthread_mutex_destroy(&heap->lock);
+  // The pool lives inside its own region, so one munmap drops everything.
+  // Heaps in caller buffers have nothing to release.
+  if (heap->mapStart != NULL)
+    munmap(heap->mapStart, heap->mapSize);
+}
+
+void *myAlloc(size_t size) { return myHeapAlloc(main_heap(), size); }
+
+void myFree(void *p) { myHeapFree(main_heap(), p); }
@@ -0,0 +1,224 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * Heap handles shared by every allocator strategy in src/.
+ *
+ * Each strategy (fixed_block.c, implicit_free _list.c) defines its own
+ * struct myHeap, so a program links exactly one of them. A heap either
+ * lives in a caller-provided buffer or in its own mmap'd region; in both
+ * cases the bookkeeping sits at the start of that region, so a subsystem's
+ * data stays contiguous and destroying the heap is O(1).
+ */
+typedef struct myHeap myHeap;
+
+// myHeapCreate flags
+#define MYHEAP_NONE 0
+#define MYHEAP_ZERO (1 << 0)   // zero-fill every allocation
+#define MYHEAP_SHARED (1 << 1)     // set by myHeapCreateShared
+#define MYHEAP_PERSISTENT (1 << 2) // set by myHeapOpenFile
+#define MYHEAP_MAGAZINES (1 << 3)  // fixed block: per-thread magazine caches
+#define MYHEAP_NO_COLOR (1 << 4)   // fixed block: no slab coloring
+#define MYHEAP_OOB_META (1 << 5)   // implicit list: no inline headers
+#define MYHEAP_FREE_INDEX (1 << 6) // implicit list: SIMD-scanned free index
+#define MYHEAP_FAST_BINS (1 << 7)  // implicit list: defer small coalescing
+// Implicit list, heaps myHeapCreate maps: page faults off the alloc path
+#define MYHEAP_POPULATE (1 << 8) // fault each committed grow step in at once
+#define MYHEAP_PREFAULT (1 << 9) // fault the next grow step in on a thread
+#define MYHEAP_MLOCK (1 << 10)   // keep the committed heap resident
+// Implicit list: lock every call, so myHeapMaintain may take the heap
+#define MYHEAP_MAINTAINED (1 << 11)
+
+// buffer == NULL: map `size` bytes of fresh memory for the heap.
+// buffer != NULL: carve the heap out of the caller's buffer, which must
+// stay valid until myHeapDestroy.
+myHeap *myHeapCreate(void *buffer, size_t size, int flags);
+void *myHeapAlloc(myHeap *heap, size_t size);
+void myHeapFree(myHeap *heap, void *p);
+// Like realloc: keeps the block when it is already large enough, otherwise
+// moves the payload to a new block. Returns NULL (and keeps p) on failure.
+void *myHeapRealloc(myHeap *heap, void *p, size_t size);
+// Releases the whole heap at once; every pointer from it becomes invalid.
+void myHeapDestroy(myHeap *heap);
+
+// Latency percentiles of one operation, in timer ticks (cycles on x86)
+struct myHeapLatency {
+  uint64_t count;
+  uint64_t p50, p90, p99, p999, max;
+};
+
+struct myHeapStats {
+  size_t mappedBytes; // committed bytes of the heap's region
+  size_t usedBytes;   // carved into blocks so far, metadata included
+  size_t liveBytes;   // payload of allocated blocks
+  size_t freeBytes;   // payload of free blocks
+  size_t liveBlocks;
+  size_t freeBlocks;
+  // Builds with -DHEAP_LATENCY only, merged over all threads and heaps
+  struct myHeapLatency allocFast, allocSlow, freeFast, freeSlow;
+};
+
+void myHeapGetStats(myHeap *heap, struct myHeapStats *stats);
+// Walks the whole heap and checks its invariants. Returns 0 when the heap
+// is consistent, otherwise reports the first problem on stderr and returns -1.
+int myHeapCheck(myHeap *heap);
+
+// Live-heap report: live and free blocks by size class, the largest free
+// block (to tell fragmentation from leaks) and, in HEAP_PROFILER builds,
+// the call sites owning the most live memory. Blocks parked in fast bins
+// or in the depot's and caller's magazines count as free. heap == NULL
+// means the default heap.
+void myHeapReport(myHeap *heap, FILE *out);
+// Writes the report for heap to stderr when the process exits
+void myHeapReportAtExit(myHeap *heap);
+
+// Fixed block only: hands the calling thread's cached blocks for heap
+// back to it (done automatically at thread exit)
+void myHeapFlushCache(myHeap *heap);
+
+/**
+ * Fixed block only: object caching, after the Solaris slab allocator.
+ * A block is constructed by ctor when it is first handed out and stays
+ * constructed while it sits free in the pool, so myHeapAlloc returns ready
+ * objects and myHeapFree should leave them in their constructed state.
+ * MYHEAP_ZERO is ignored for such heaps. Register the callbacks before the
+ * first allocation.
+ */
+// Returns 0 on success; a failing ctor makes myHeapAlloc return NULL
+typedef int (*myHeapCtor)(void *obj, void *arg);
+typedef void (*myHeapDtor)(void *obj, void *arg);
+// Asks the owner to free objects it can spare, e.g. drop its own caches
+typedef void (*myHeapReclaimHook)(void *arg);
+// Any callback may be NULL. Returns -1 when the heap has live blocks.
+int myHeapSetObjectCache(myHeap *heap, myHeapCtor ctor, myHeapDtor dtor,
+                         myHeapReclaimHook reclaim, void *arg);
+// For memory pressure: destructs every cached free object, releases the
+// pages they span and returns the number of objects destructed
+size_t myHeapReclaim(myHeap *heap);
+
+/**
+ * Implicit free list only: large objects. On a heap myHeapCreate mapped,
+ * requests of large_threshold bytes and more (see myMallopt) are mapped on
+ * their own, beside the heap. Such an object reserves address space for
+ * all it may grow to and commits pages only as it grows, so myHeapRealloc
+ * within the reservation neither copies nor moves it: growing costs the
+ * pages touched, shrinking gives the pages above the new size back, and
+ * pointers into the object stay valid. Past the reservation myHeapRealloc
+ * moves it like any block. myHeapFree unmaps it.
+ */
+// A large object of size bytes that can grow to maxSize in place, e.g. an
+// append-only buffer. Returns NULL if the range cannot be reserved.
+void *myHeapAllocGrowable(myHeap *heap, size_t size, size_t maxSize);
+
+/**
+ * Implicit free list only: a heap inside a shared memory segment
+ * (memfd_create or shm_open). Every process maps the segment wherever it
+ * likes and passes blocks around as offsets; allocs and frees from any
+ * process are serialised by a process-shared, robust lock in the heap.
+ */
+// Formats the segment behind fd (resized to size) as an empty heap
+myHeap *myHeapCreateShared(int fd, size_t size, int flags);
+// Maps a segment already formatted by myHeapCreateShared
+myHeap *myHeapAttach(int fd);
+// Translate between this process's pointers and segment offsets
+size_t myHeapOffset(myHeap *heap, void *p);
+void *myHeapPointer(myHeap *heap, size_t offset);
+
+/**
+ * Implicit free list only: a heap persisted in a file. The first open
+ * formats the file; later opens (e.g. after a restart) map it again and
+ * the blocks are usable as they are. Pass MYHEAP_SHARED to also open it
+ * from several processes at once.
+ */
+myHeap *myHeapOpenFile(const char *path, size_t size, int flags);
+// Flushes the heap to its file, returns 0 on success
+int myHeapSync(myHeap *heap);
+// One block the owner can find again after reopening, e.g. a table root
+void myHeapSetRoot(myHeap *heap, void *p);
+void *myHeapGetRoot(myHeap *heap);
+
+/**
+ * Implicit free list only: glibc's malloc introspection, for the default
+ * heap, so dashboards built on mallinfo2/malloc_stats/malloc_trim keep
+ * working. Build with -DMYALLOC_GLIBC_NAMES to export them under glibc's
+ * names too (glibc 2.33 and later).
+ */
+// Same fields and meaning as glibc's struct mallinfo2
+struct myMallinfo2 {
+  size_t arena;    // heapEnd - heapStart
+  size_t ordblks;  // free blocks, fast bins excluded
+  size_t smblks;   // blocks in fast bins
+  size_t hblks;    // large objects mapped on their own
+  size_t hblkhd;   // bytes of those
+  size_t usmblks;  // always 0
+  size_t fsmblks;  // bytes in fast bins
+  size_t uordblks; // payload of allocated blocks
+  size_t fordblks; // payload of free blocks, fast bins included
+  size_t keepcost; // committed top chunk, what trimming could release
+};
+struct myMallinfo2 myMallinfo2(void);
+// Prints system and in-use bytes to stderr, in malloc_stats' format; the
+// max mmap lines are the large objects' high-water marks
+void myMallocStats(void);
+// Releases free pages and all but pad bytes of the top chunk; returns 1
+// if memory went back to the OS, 0 otherwise
+int myMallocTrim(size_t pad);
+// malloc_info's XML; options must be 0
+int myMallocInfo(int options, FILE *out);
+// myMallocTrim for any heap. Only heaps that myHeapCreate mapped release
+// memory: caller buffers and files are not the heap's to give back.
+int myHeapTrim(myHeap *heap, size_t pad);
+
+/**
+ * Implicit free list only: background maintenance. With maintenance_ms
+ * set (see myMallopt), a thread wakes up that often to consolidate fast
+ * bins, release the pages of blocks free for purge_ms or longer and trim
+ * the top chunk, so request threads do less of it. It looks after the
+ * heaps passed to myHeapMaintain, which must have been created with
+ * MYHEAP_MAINTAINED (or be shared) so that they lock on every call from
+ * the start. The default heap is one of them when maintenance_ms is set
+ * (MYALLOC_CONF or myMallopt) before its first allocation. Setting
+ * maintenance_ms with myMallopt starts the thread, or ends it when set to
+ * 0. The thread stops at exit and does not survive fork; myHeapMaintain
+ * starts it again.
+ */
+// Returns -1 when heap does not lock or too many heaps are maintained
+// already.
+int myHeapMaintain(myHeap *heap);
+// Stops the thread and waits for it
+void myHeapMaintainStop(void);
+
+/**
+ * Runtime tunables, after mallopt. They start from the built-in defaults,
+ * are overridden by the MYALLOC_CONF environment variable when the
+ * allocator first needs them, e.g.
+ *
+ *   MYALLOC_CONF="heap_size:4g,grow_step:8m,magazine_size:16"
+ *
+ * (sizes take a k, m or g suffix) and by myMallopt after that. Heaps read
+ * them when they are created, so a change only affects heaps created later
+ * and, if it does not exist yet, the default heap.
+ */
+enum myMalloptParam {
+  MYMALLOPT_HEAP_SIZE,       // bytes of the default heap
+  MYMALLOPT_GROW_STEP,       // implicit list: bytes the top commits at once
+  MYMALLOPT_LARGE_THRESHOLD, // implicit list: smallest large request
+  MYMALLOPT_PURGE_MS,        // implicit list: age of free pages to purge
+  MYMALLOPT_MAGAZINE_SIZE,   // fixed block: blocks per magazine
+  MYMALLOPT_FAST_MAX,        // implicit list: largest fast-bin block
+  MYMALLOPT_MAINTENANCE_MS,  // implicit list: background period, 0 = off
+  MYMALLOPT_PARAMS
+};
+// Returns 0 on success, -1 for a parameter the linked strategy does not
+// have or a value out of its range
+int myMallopt(int param, size_t value);
+
+// Process-wide default heap, created on first use
+void *myAlloc(size_t size);
+void myFree(void *p);
+
+#endif
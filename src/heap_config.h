@@ -0,0 +1,92 @@
+#ifndef HEAP_CONFIG_H
+#define HEAP_CONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "heap.h"
+
+/**
+ * MYALLOC_CONF / myMallopt parsing, shared by the strategies.
+ *
+ * Each strategy keeps a table of its tunables (see enum myMalloptParam)
+ * with defaults and limits; a tunable it does not have has max == 0. The
+ * variable is parsed in place, without allocating, since it is read while
+ * the allocator itself is being set up: comma separated name:value pairs,
+ * values in decimal with an optional k, m or g (binary) suffix. Entries
+ * that do not parse or are out of range are reported and skipped.
+ */
+
+struct heapTunable {
+  size_t value;
+  size_t min, max;
+};
+
+static const char *const heapTunableNames[MYMALLOPT_PARAMS] = {
+    [MYMALLOPT_HEAP_SIZE] = "heap_size",
+    [MYMALLOPT_GROW_STEP] = "grow_step",
+    [MYMALLOPT_LARGE_THRESHOLD] = "large_threshold",
+    [MYMALLOPT_PURGE_MS] = "purge_ms",
+    [MYMALLOPT_MAGAZINE_SIZE] = "magazine_size",
+    [MYMALLOPT_FAST_MAX] = "fast_max",
+    [MYMALLOPT_MAINTENANCE_MS] = "maintenance_ms",
+};
+
+// Sets one tunable, returns -1 if it does not exist or value is out of range
+static int config_set(struct heapTunable *t, int param, size_t value) {
+  if (param < 0 || param >= MYMALLOPT_PARAMS || t[param].max == 0 ||
+      value < t[param].min || value > t[param].max)
+    return -1;
+  __atomic_store_n(&t[param].value, value, __ATOMIC_RELAXED);
+  return 0;
+}
+
+// Parses "<digits>[kmg]" spanning exactly len bytes, -1 on garbage
+static int config_number(const char *s, size_t len, size_t *value) {
+  size_t v = 0, i = 0;
+  for (; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+    if (v > (SIZE_MAX - 9) / 10)
+      return -1;
+    v = v * 10 + (size_t)(s[i] - '0');
+  }
+  if (i == 0)
+    return -1;
+  if (i + 1 == len) {
+    int shift = s[i] == 'k' || s[i] == 'K'   ? 10
+                : s[i] == 'm' || s[i] == 'M' ? 20
+                : s[i] == 'g' || s[i] == 'G' ? 30
+                                             : -1;
+    if (shift < 0 || v > SIZE_MAX >> shift)
+      return -1;
+    v <<= shift;
+  } else if (i != len) {
+    return -1;
+  }
+  *value = v;
+  return 0;
+}
+
+// Applies every name:value entry of conf (may be NULL) to t
+static void config_parse(struct heapTunable *t, const char *conf) {
+  while (conf != NULL && *conf != '\0') {
+    const char *end = strchr(conf, ',');
+    size_t len = end != NULL ? (size_t)(end - conf) : strlen(conf);
+    const char *colon = memchr(conf, ':', len);
+    int ok = 0;
+    for (int p = 0; colon != NULL && !ok && p < MYMALLOPT_PARAMS; p++) {
+      size_t nameLen = colon - conf, value;
+      ok = strlen(heapTunableNames[p]) == nameLen &&
+           memcmp(conf, heapTunableNames[p], nameLen) == 0 &&
+           config_number(colon + 1, len - nameLen - 1, &value) == 0 &&
+           config_set(t, p, value) == 0;
+    }
+    if (!ok && len > 0)
+      fprintf(stderr, "Allocator error: MYALLOC_CONF: ignoring \"%.*s\"\n",
+              (int)len, conf);
+    conf = end != NULL ? end + 1 : NULL;
+  }
+}
+
+#endif
@@ -0,0 +1,280 @@
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "heap_profiler.h"
+
+/**
+ * Plan:
+ * - every thread counts down the bytes it allocates; when the counter
+ * crosses zero the allocation is sampled and a new exponential gap drawn
+ * - a sampled allocation is charged to its call site (a backtrace), both
+ * in the in-use and in the cumulative counts
+ * - live samples are kept in a hash table keyed by pointer, so the free
+ * can find the site again and uncharge the in-use counts
+ * - both tables are fixed size and static: the profiler never allocates
+ * from the heap it is watching
+ */
+
+#define MAX_SITES 4096      // distinct call sites
+#define MAX_SAMPLES 16384   // live sampled blocks, power of two
+#define RECHECK_BYTES (1 << 20) // how often a disabled thread looks again
+
+struct site {
+  uint64_t hash; // 0 = empty slot
+  int depth;
+  void *stack[HEAP_PROFILER_MAX_DEPTH];
+  size_t inuseObjs, inuseBytes;
+  size_t allocObjs, allocBytes;
+};
+
+struct sample {
+  void *p; // NULL = empty slot
+  size_t size;
+  struct site *site;
+};
+
+static struct site sites[MAX_SITES];
+static struct sample samples[MAX_SAMPLES];
+static size_t dropped; // samples lost to full tables
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile int enabled;
+static size_t meanBytes;
+
+static volatile sig_atomic_t dumpRequested;
+static char dumpPath[256];
+
+__thread int64_t heap_profiler_bytes_left;
+static __thread uint64_t rngState;
+
+// xorshift64*, seeded per thread from its own address
+static uint64_t next_random(void) {
+  if (rngState == 0)
+    rngState = (uintptr_t)&rngState | 1;
+  rngState ^= rngState >> 12;
+  rngState ^= rngState << 25;
+  rngState ^= rngState >> 27;
+  return rngState * 0x2545f4914f6cdd1dULL;
+}
+
+// Exponentially distributed gap with mean meanBytes
+static int64_t next_gap(void) {
+  // 53 random bits --> uniform in (0, 1]
+  double u = ((next_random() >> 11) + 1) * (1.0 / 9007199254740992.0);
+  return (int64_t)(-log(u) * (double)meanBytes) + 1;
+}
+
+int heap_profiler_pick(size_t size) {
+  (void)size;
+  if (dumpRequested) {
+    dumpRequested = 0;
+    heapProfilerDump(dumpPath);
+  }
+  if (!enabled) {
+    heap_profiler_bytes_left = RECHECK_BYTES;
+    return 0;
+  }
+  heap_profiler_bytes_left = next_gap();
+  return 1;
+}
+
+void heapProfilerStart(size_t sampleBytes) {
+  meanBytes = sampleBytes ? sampleBytes : 1;
+  enabled = 1;
+}
+
+void heapProfilerStop(void) { enabled = 0; }
+
+// Walks the frame-pointer chain; needs -fno-omit-frame-pointer
+__attribute__((noinline)) static int capture_stack(void **stack, int skip) {
+  void **fp = (void **)__builtin_frame_address(0);
+  int depth = 0;
+  while (fp != NULL && depth < HEAP_PROFILER_MAX_DEPTH) {
+    void **next = (void **)fp[0];
+    void *ret = fp[1];
+    if (ret == NULL)
+      break;
+    if (skip > 0)
+      skip--;
+    else
+      stack[depth++] = ret;
+    // Frames grow towards higher addresses; anything else means the chain
+    // left code built with frame pointers
+    if (next <= fp || (char *)next - (char *)fp > (1 << 20) ||
+        ((uintptr_t)next & (sizeof(void *) - 1)))
+      break;
+    fp = next;
+  }
+  return depth;
+}
+
+static uint64_t hash_stack(void *const *stack, int depth) {
+  uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a over the addresses
+  for (int i = 0; i < depth; i++) {
+    h ^= (uintptr_t)stack[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h ? h : 1;
+}
+
+static size_t hash_ptr(void *p) {
+  return ((uintptr_t)p >> 3) * 0x9e3779b97f4a7c15ULL >> 32;
+}
+
+// Call with lock held
+static struct site *find_site(void *const *stack, int depth) {
+  uint64_t h = hash_stack(stack, depth);
+  for (size_t n = 0, i = h % MAX_SITES; n < MAX_SITES;
+       n++, i = (i + 1) % MAX_SITES) {
+    struct site *s = &sites[i];
+    if (s->hash == 0) {
+      s->hash = h;
+      s->depth = depth;
+      memcpy(s->stack, stack, depth * sizeof(void *));
+      return s;
+    }
+    if (s->hash == h && s->depth == depth &&
+        memcmp(s->stack, stack, depth * sizeof(void *)) == 0)
+      return s;
+  }
+  return NULL;
+}
+
+void heapProfilerRecordAlloc(void *p, size_t size) {
+  void *stack[HEAP_PROFILER_MAX_DEPTH];
+  // Skip capture_stack's caller, i.e. this function
+  int depth = capture_stack(stack, 1);
+
+  pthread_mutex_lock(&lock);
+  struct site *s = find_site(stack, depth);
+  size_t i = hash_ptr(p) & (MAX_SAMPLES - 1);
+  size_t n = 0;
+  while (samples[i].p != NULL && n++ < MAX_SAMPLES)
+    i = (i + 1) & (MAX_SAMPLES - 1);
+  if (s == NULL || samples[i].p != NULL) {
+    dropped++;
+  } else {
+    samples[i].p = p;
+    samples[i].size = size;
+    samples[i].site = s;
+    s->inuseObjs++;
+    s->inuseBytes += size;
+    s->allocObjs++;
+    s->allocBytes += size;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+// Deletes slot i without tombstones: later entries of the same probe run
+// move back into the hole (linear probing deletion)
+static void remove_sample(size_t i) {
+  size_t j = i;
+  for (;;) {
+    samples[i].p = NULL;
+    for (;;) {
+      j = (j + 1) & (MAX_SAMPLES - 1);
+      if (samples[j].p == NULL)
+        return;
+      size_t k = hash_ptr(samples[j].p) & (MAX_SAMPLES - 1);
+      // Leave j alone if its home slot k lies cyclically in (i, j]
+      if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+        continue;
+      break;
+    }
+    samples[i] = samples[j];
+    i = j;
+  }
+}
+
+void heapProfilerRecordFree(void *p) {
+  pthread_mutex_lock(&lock);
+  size_t i = hash_ptr(p) & (MAX_SAMPLES - 1);
+  for (size_t n = 0; samples[i].p != NULL && n < MAX_SAMPLES; n++) {
+    if (samples[i].p == p) {
+      struct site *s = samples[i].site;
+      s->inuseObjs--;
+      s->inuseBytes -= samples[i].size;
+      remove_sample(i);
+      break;
+    }
+    i = (i + 1) & (MAX_SAMPLES - 1);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+int heapProfilerDump(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL)
+    return -1;
+
+  pthread_mutex_lock(&lock);
+  size_t inuseObjs = 0, inuseBytes = 0, allocObjs = 0, allocBytes = 0;
+  for (size_t i = 0; i < MAX_SITES; i++) {
+    inuseObjs += sites[i].inuseObjs;
+    inuseBytes += sites[i].inuseBytes;
+    allocObjs += sites[i].allocObjs;
+    allocBytes += sites[i].allocBytes;
+  }
+  // heap_v2/<rate> tells pprof to unsample the counts
+  fprintf(f, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", inuseObjs,
+          inuseBytes, allocObjs, allocBytes, meanBytes);
+  for (size_t i = 0; i < MAX_SITES; i++) {
+    struct site *s = &sites[i];
+    if (s->hash == 0)
+      continue;
+    fprintf(f, "%zu: %zu [%zu: %zu] @", s->inuseObjs, s->inuseBytes,
+            s->allocObjs, s->allocBytes);
+    for (int d = 0; d < s->depth; d++)
+      fprintf(f, " 0x%" PRIxPTR, (uintptr_t)s->stack[d]);
+    fputc('\n', f);
+  }
+  if (dropped)
+    fprintf(stderr, "heap profiler: %zu samples dropped, tables full\n",
+            dropped);
+  pthread_mutex_unlock(&lock);
+
+  // pprof needs the load addresses to symbolize
+  fputs("\nMAPPED_LIBRARIES:\n", f);
+  FILE *maps = fopen("/proc/self/maps", "r");
+  if (maps != NULL) {
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), maps)) > 0)
+      fwrite(buf, 1, n, f);
+    fclose(maps);
+  }
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+void heapProfilerForEachSite(heapProfilerSiteFn fn, void *arg) {
+  pthread_mutex_lock(&lock);
+  for (size_t i = 0; i < MAX_SITES; i++) {
+    struct site *s = &sites[i];
+    if (s->hash == 0 || s->inuseObjs == 0)
+      continue;
+    // An object of size b is sampled with probability 1 - e^(-b/mean)
+    double avg = (double)s->inuseBytes / s->inuseObjs;
+    double scale = 1.0 / (1.0 - exp(-avg / (double)meanBytes));
+    fn(s->stack, s->depth, (size_t)(s->inuseObjs * scale),
+       (size_t)(s->inuseBytes * scale), arg);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+static void on_dump_signal(int signo) {
+  (void)signo;
+  dumpRequested = 1;
+}
+
+void heapProfilerDumpOnSignal(int signo, const char *path) {
+  strncpy(dumpPath, path, sizeof(dumpPath) - 1);
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_dump_signal;
+  sa.sa_flags = SA_RESTART;
+  sigaction(signo, &sa, NULL);
+}
@@ -0,0 +1,65 @@
+#ifndef HEAP_PROFILER_H
+#define HEAP_PROFILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Sampling heap profiler.
+ *
+ * Build the allocator with -DHEAP_PROFILER -fno-omit-frame-pointer and link
+ * heap_profiler.c (and -lm). Roughly one allocation per `sampleBytes`
+ * allocated bytes is sampled: the gap to the next sample is drawn from an
+ * exponential distribution, so every byte is equally likely to be picked
+ * (a Poisson process over allocated bytes). Sampled allocations get a
+ * frame-pointer backtrace and are tracked until they are freed.
+ *
+ * Profiles are written in the legacy gperftools heap format that pprof
+ * reads, with in-use and cumulative counts per call site:
+ *   pprof --inuse_space ./prog heap.prof
+ *   pprof --alloc_space ./prog heap.prof
+ */
+
+#define HEAP_PROFILER_MAX_DEPTH 32
+
+// Starts sampling; sampleBytes is the mean gap between two samples
+void heapProfilerStart(size_t sampleBytes);
+void heapProfilerStop(void);
+// Writes the current profile to path, returns 0 on success
+int heapProfilerDump(const char *path);
+// Dumps to path whenever signo arrives. The handler only raises a flag;
+// the dump itself happens on the next sampling decision of any thread.
+void heapProfilerDumpOnSignal(int signo, const char *path);
+
+/**
+ * Allocator hooks.
+ */
+
+// Bytes left until this thread's next sample
+extern __thread int64_t heap_profiler_bytes_left;
+
+int heap_profiler_pick(size_t size);
+
+// The whole cost of an unsampled allocation: one subtract and one branch
+static inline int heapProfilerShouldSample(size_t size) {
+  heap_profiler_bytes_left -= (int64_t)size;
+  if (heap_profiler_bytes_left > 0)
+    return 0;
+  return heap_profiler_pick(size);
+}
+
+// Records a sampled allocation; call only when heapProfilerShouldSample said
+// so and flag the block so the matching free is reported
+void heapProfilerRecordAlloc(void *p, size_t size);
+void heapProfilerRecordFree(void *p);
+
+/**
+ * Walks the call sites that still own sampled memory. Counts are scaled
+ * back up from the samples, i.e. estimates of the real in-use objects and
+ * bytes, as pprof would show them.
+ */
+typedef void (*heapProfilerSiteFn)(void *const *stack, int depth,
+                                   size_t objects, size_t bytes, void *arg);
+void heapProfilerForEachSite(heapProfilerSiteFn fn, void *arg);
+
+#endif
@@ -1,9 +1,32 @@
+#define _GNU_SOURCE // memfd_create
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "heap.h"
+#include "heap_config.h"
+#include "probes.h"
+#include "size_scan.h"
+#ifdef HEAP_LATENCY
+#include "latency_hist.h"
+#endif
+#ifdef HEAP_PROFILER
+#include "heap_profiler.h"
+#endif
+#if defined(MYALLOC_GLIBC_NAMES) && defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 /*
 Notes:
@@ -37,7 +60,9 @@ performing pointer arithmetic, so there's no need to do it explicitly.
 | 48      | `0011 0000` |
 
 Bit position:  [63 ............... 3][2][1][0]
-               ^ actual size bits   | unused  | free flag
+               ^ actual size bits   |  | |  free flag
+                                    |  | sampled by the heap profiler
+                                    |  unused
 
 Example:
  size=24 (aligned) → binary:   000...000 11000
@@ -52,7 +77,75 @@ Example:
  *    - whether the block is free (1) or allocated (0)
  * - when allocating, walk linearly from heap start to heap end and check
  * if there is a free block (use block's header) to find a first fit
- * -
+ * - every heap is an instance: its struct myHeap sits at the start of its
+ * own region, followed by the blocks
+ *
+ * | struct myHeap | header | data | header | data | ... | heapEnd ... heapMax
+ *                 ^ heapStart
+ *
+ * Out-of-band metadata (MYHEAP_OOB_META): inline headers put one header
+ * per block in the path of every heap walk (a cache line per block) and
+ * right behind every payload, where an overflow clobbers them. In this
+ * mode the heap is cut into OOB_GRANULE byte granules and each block's
+ * size and flags live in a 32-bit entry of a separate array, indexed by
+ * the granule the block starts at (entries of the other granules are 0):
+ *
+ * | struct myHeap | meta[granules] | pad | data | data | ... | heapEnd ...
+ *                                         ^ heapStart (OOB_GRANULE aligned)
+ *
+ * Searches then scan 16 entries per cache line without touching payload
+ * pages, and payloads follow each other without gaps. Block sizes are
+ * rounded to whole granules instead of ALIGNMENT, and a free of a pointer
+ * that does not start a block is caught.
+ *
+ * Free index (MYHEAP_FREE_INDEX, private heaps only): a side index of the
+ * free blocks in address order, as two arrays in a mapping of their own:
+ * sizes (uint32_t, saturated at 4 GiB) and payload offsets. First fit is
+ * then the first index entry whose size is large enough, found with a
+ * SIMD scan of the sizes (size_scan.h) instead of a header chase through
+ * every block. Frees insert into the index (binary search plus memmove),
+ * reuses remove from it. If the index cannot grow, it is dropped and the
+ * heap goes back to walking.
+ *
+ * Splitting and coalescing: a reused block gives the part it does not
+ * need back as a free block of its own, and a freed block absorbs the
+ * free blocks right after it. Headers only lead forward, so a free block
+ * in front of it is not merged then; consolidation (below) catches those.
+ *
+ * Fast bins (MYHEAP_FAST_BINS, after dlmalloc): freeing a block of up to
+ * fast_max bytes (at most FAST_MAX) pushes it onto a LIFO list for its exact size instead,
+ * linked through the payload. It stays marked allocated, so nothing merges
+ * with it and the next request of that size pops it without a search.
+ * Only when a request finds no free block does consolidation empty the
+ * bins and merge every run of free blocks in one pass over the heap.
+ *
+ * Top chunk: heapEnd .. topEnd is the wilderness, the one free area that
+ * can serve any size. It is carved only when no free block fits, and a
+ * free (or consolidated) block that ends on heapEnd is handed back to it
+ * instead of becoming a free block, so the top stays as large as it can
+ * be. A heap mapped by myHeapCreate only reserves its region (PROT_NONE)
+ * and commits it grow_step bytes at a time as the top needs room, so it
+ * grows in place up to heapMax:
+ *
+ * ... | last block | top chunk (committed) | reserved ... | heapMax
+ *                  ^ heapEnd               ^ topEnd
+ *
+ * The first write to a fresh page faults, inside whatever handler happened
+ * to allocate it. MYHEAP_POPULATE commits with MAP_POPULATE so the faults
+ * happen in myHeapCreate and the rare grow step, MYHEAP_PREFAULT has a
+ * thread fault in the next grow step before the top reaches it, and
+ * MYHEAP_MLOCK pins what is committed (purging then skips the heap).
+ *
+ * Large objects: on a heap myHeapCreate mapped, a request of at least
+ * large_threshold bytes is not carved from the top but mapped on its own,
+ * after a one-cache-line header that links it into the heap's list. The
+ * mapping reserves (PROT_NONE) all the object may grow to, which is its
+ * size for plain myHeapAlloc and maxSize for myHeapAllocGrowable, and
+ * commits whole pages as the object grows. myHeapRealloc within the
+ * reservation commits or releases pages and never moves the payload:
+ *
+ * | header | payload ...  | committed tail | reserved ...           |
+ * ^ largeObject          ^ size          ^ committed              ^ reserved
  */
 
 #if defined(__x86_64__) || defined(_M_X64) || defined(__aarch64__) ||          \
@@ -64,39 +157,197 @@ Example:
 
 // Aligns a size s upwards to the next multiple of ALIGNMENT value
 #define ALIGN(s) (((uintptr_t)(s) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
-#define HEAP_SIZE (1 << 20) // 1 Mb
+// Default heap: reserved up front, committed as it grows
+#define HEAP_SIZE ((size_t)1 << (sizeof(void *) >= 8 ? 30 : 24))
+#define HEAP_SIZE_MAX ((size_t)1 << (sizeof(void *) >= 8 ? 46 : 30))
+#define TOP_GROW_STEP ((size_t)1 << 20) // commit granularity of the top
+#define LARGE_THRESHOLD ((size_t)128 << 10)
+#define LARGE_HEADER 64 // keeps large payloads cache line aligned
+#define PURGE_MS 10000
+#define MAINT_HEAPS 16 // heaps the maintenance thread looks after
 
-// Masks out the lowest bit to give only the aligned size
-#define GET_SIZE(h) (h->meta_data & ~(size_t)1)
-#define IS_FREE(h) (h->meta_data & 1)
-#define SET_SIZE(h, s) (h->meta_data = ((s) & ~(size_t)1) | (h->meta_data & 1))
-#define MARK_ALLOCATED(h) (h->meta_data &= ~(size_t)1)
-#define MARK_FREE(h) (h->meta_data |= (size_t)1)
+// A block's metadata word (see struct header) and its parts. Masks out the
+// flag bits to give only the aligned size.
+#define FLAG_BITS ((size_t)ALIGNMENT - 1)
+#define GET_SIZE(m) ((m) & ~FLAG_BITS)
+#define IS_FREE(m) ((m) & 1)
+#define MARK_ALLOCATED(m) ((m) & ~(size_t)1)
+#define MARK_FREE(m) ((m) | (size_t)1)
+#define IS_SAMPLED(m) ((m) & 2)
+#define MARK_SAMPLED(m) ((m) | (size_t)2)
+#define CLEAR_SAMPLED(m) ((m) & ~(size_t)2)
+// On a free block the same bit means aged: free since the last aging pass
+#define IS_AGED(m) ((m) & 2)
+#define MARK_AGED(m) ((m) | (size_t)2)
+
+#define OOB_GRANULE 16 // MYHEAP_OOB_META: bytes per metadata entry
+#define FAST_MAX 128   // MYHEAP_FAST_BINS: largest block kept in a bin
+#define FAST_BINS (FAST_MAX / ALIGNMENT + 1) // one per aligned size
+// Largest block an entry can describe: 30 bits of granules
+#define OOB_MAX_SIZE (((size_t)UINT32_MAX >> 2) * OOB_GRANULE)
 
 // Error codes
 #define ERR_NONE 0
 #define ERR_MMAP_FAILED -1
 #define ERR_OUT_OF_MEM -2
 #define ERR_INVALID_FREE -3
+#define ERR_BAD_HEAP -4
 
 // Global error state
 static int last_error = ERR_NONE;
 
-void *heapStart = NULL;
-void *heapEnd = NULL;
-void *heapMax = NULL;
+// Internal flags, kept clear of the public MYHEAP_* bits
+#define HEAP_MAPPED (1 << 16) // region is our mapping, munmap on destroy
+#define HEAP_FRESH (1 << 17)  // region was zero-filled when created
+#define HEAP_GROWABLE (1 << 18) // only commitOff bytes are accessible yet
+
+#ifndef MAP_POPULATE // macOS: region_commit touches the pages instead
+#define MAP_POPULATE 0
+#endif
+
+// Superblock stamp: a shared segment or heap file is only attached when
+// both match, so a reopened file is known to have this exact layout
+#define HEAP_MAGIC 0x70616548794dULL // "MyHeap"
+#define HEAP_VERSION 9
+
+// Starts a large object's mapping; the payload follows at LARGE_HEADER
+struct largeObject {
+  struct largeObject *next, *prev;
+  size_t size;      // payload bytes asked for
+  size_t committed; // accessible bytes from the header on, whole pages
+  size_t reserved;  // length of the mapping
+  int sampled;      // HEAP_PROFILER: recorded as sampled
+};
+
+// The heap only stores offsets from its own struct, never raw pointers.
+// The same heap can then be mapped at a different address in every process
+// that shares it (the block chain itself is already position independent:
+// each header only records its size). For the same reason a heap file can
+// be mapped again after a restart and used without any deserialization;
+// struct myHeap doubles as its superblock.
+struct myHeap {
+  uint64_t magic;
+  uint32_t version;
+  size_t startOff; // heapStart: first block header
+  size_t endOff;   // heapEnd: end of the last block
+  size_t maxOff;   // heapMax: end of the region
+  size_t topOff;   // topEnd: end of the top chunk, i.e. of the committed part
+  size_t dirtyOff; // highest heapEnd so far; fresh memory above it is zero
+  size_t mapSize;  // length of the region
+  size_t rootOff;  // entry point set by the owner, 0 if none
+  size_t metaOff;  // MYHEAP_OOB_META: the metadata array
+  size_t fastBins[FAST_BINS]; // MYHEAP_FAST_BINS: first block, 0 if empty
+  size_t fastMax;  // largest block a fast bin takes
+  size_t growStep; // bytes top_extend commits at once, whole pages
+  uint64_t agedAt; // maintenance: time of the last aging pass, in ms
+  size_t largeMin; // smallest request mapped as a large object
+  int flags;
+  pthread_mutex_t lock; // MYHEAP_SHARED and maintained heaps only
+  // MYHEAP_FREE_INDEX: process-local pointers, so never in shared heaps
+  uint32_t *freeSizes;
+  size_t *freeOffs; // payload offsets, ascending
+  size_t freeCount;
+  size_t freeCap;
+  // Large objects, most recent first; mapped (so private) heaps only
+  struct largeObject *large;
+  size_t largeCount, largeBytes;       // live ones, committed bytes
+  size_t largeMaxCount, largeMaxBytes; // high-water marks of both
+};
+
+#define HEAP_START(heap) ((char *)(heap) + (heap)->startOff)
+#define HEAP_END(heap) ((char *)(heap) + (heap)->endOff)
+#define HEAP_MAX(heap) ((char *)(heap) + (heap)->maxOff)
+
+// Backs myAlloc/myFree, created on first use
+static myHeap *defaultHeap = NULL;
+
+// Built-in defaults and limits of the tunables (see heap_config.h)
+static struct heapTunable tunables[MYMALLOPT_PARAMS] = {
+    [MYMALLOPT_HEAP_SIZE] = {HEAP_SIZE, 4096, HEAP_SIZE_MAX},
+    [MYMALLOPT_GROW_STEP] = {TOP_GROW_STEP, 4096, (size_t)1 << 30},
+    [MYMALLOPT_LARGE_THRESHOLD] = {LARGE_THRESHOLD, 4096, HEAP_SIZE_MAX},
+    [MYMALLOPT_PURGE_MS] = {PURGE_MS, 1, 24 * 3600 * 1000},
+    [MYMALLOPT_FAST_MAX] = {FAST_MAX, 0, FAST_MAX},
+    [MYMALLOPT_MAINTENANCE_MS] = {0, 0, 24 * 3600 * 1000},
+};
+static pthread_once_t tunablesOnce = PTHREAD_ONCE_INIT;
+
+static void tunables_load(void) {
+  config_parse(tunables, getenv("MYALLOC_CONF"));
+}
+
+static size_t tunable(int param) {
+  pthread_once(&tunablesOnce, tunables_load);
+  return __atomic_load_n(&tunables[param].value, __ATOMIC_RELAXED);
+}
+
+// grow_step in whole pages, as mprotect needs
+static size_t grow_step(void) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  return (tunable(MYMALLOPT_GROW_STEP) + page - 1) / page * page;
+}
 
 // Each allocated block includes a header that stores
 // metadata per block (its size and whether it’s free).
-// - bits 1..(N-1) = aligned size of the payload (upper bits)
+// - bits 2..(N-1) = aligned size of the payload (upper bits)
+// - bit 1 = sampled flag (1 = tracked by the heap profiler)
 // - bit 0 = free flag (0 = allocated, 1 = free)
-// [ ... size bits ... | free bit ]
+// [ ... size bits ... | sampled bit | free bit ]
 struct header {
   // size_t size;
   // int free;
   size_t meta_data;
 };
 
+#define OOB_META(heap) ((heap)->flags & MYHEAP_OOB_META)
+
+// Header bytes in front of every payload
+#define BLOCK_OVERHEAD(heap) (OOB_META(heap) ? 0 : sizeof(struct header))
+
+// The metadata entry of the block whose payload starts at b
+static uint32_t *oob_entry(myHeap *heap, char *b) {
+  return (uint32_t *)((char *)heap + heap->metaOff) +
+         (b - HEAP_START(heap)) / OOB_GRANULE;
+}
+
+// Every walk goes through block_meta/block_set_meta, so both layouts
+// share one encoding: aligned size | sampled bit | free bit
+static size_t block_meta(myHeap *heap, char *b) {
+  if (OOB_META(heap)) {
+    uint32_t e = *oob_entry(heap, b);
+    return (size_t)(e >> 2) * OOB_GRANULE | (e & 3);
+  }
+  // The header sits right before the payload: (h + 1) == b
+  return ((struct header *)b - 1)->meta_data;
+}
+
+static void block_set_meta(myHeap *heap, char *b, size_t meta) {
+  if (OOB_META(heap))
+    *oob_entry(heap, b) = (uint32_t)(GET_SIZE(meta) / OOB_GRANULE << 2 |
+                                     (meta & 3));
+  else
+    ((struct header *)b - 1)->meta_data = meta;
+}
+
+// Payload of the first block
+static char *block_first(myHeap *heap) {
+  return HEAP_START(heap) + BLOCK_OVERHEAD(heap);
+}
+
+// Payload of the block after b, given b's metadata
+static char *block_next(myHeap *heap, char *b, size_t meta) {
+  return b + GET_SIZE(meta) + BLOCK_OVERHEAD(heap);
+}
+
+// Payload size a request of size bytes gets; 0 when it is too large
+static size_t block_size(myHeap *heap, size_t size) {
+  if (!OOB_META(heap))
+    return ALIGN(size);
+  if (size > OOB_MAX_SIZE)
+    return 0;
+  return (size + OOB_GRANULE - 1) & ~(size_t)(OOB_GRANULE - 1);
+}
+
 // Helper: set error and return NULL
 static void *alloc_error(int code, const char *msg) {
   last_error = code;
@@ -111,83 +362,1762 @@ static void free_error(int code, const char *msg) {
     fprintf(stderr, "Allocator error: %s\n", msg);
 }
 
-void *myAlloc(size_t size) {
+// Lays out an empty heap at the start of region
+static myHeap *heap_init(void *region, size_t size, int flags) {
+  // The heap struct and the first header both need ALIGNMENT
+  char *start = (char *)ALIGN(region);
+  char *end = (char *)region + size;
+  if (start + ALIGN(sizeof(myHeap)) + sizeof(struct header) > end)
+    return alloc_error(ERR_OUT_OF_MEM, "Heap buffer too small");
+
+  myHeap *heap = (myHeap *)start;
+  heap->metaOff = 0;
+  heap->startOff = ALIGN(sizeof(myHeap));
+  heap->maxOff = end - start;
+  if (flags & MYHEAP_OOB_META) {
+    // Every granule costs OOB_GRANULE bytes plus its entry; up to
+    // OOB_GRANULE - 1 bytes go to aligning heapStart
+    heap->metaOff = heap->startOff;
+    size_t avail = heap->maxOff - heap->metaOff;
+    if (avail < OOB_GRANULE + sizeof(uint32_t) + OOB_GRANULE - 1)
+      return alloc_error(ERR_OUT_OF_MEM, "Heap buffer too small");
+    size_t granules =
+        (avail - (OOB_GRANULE - 1)) / (OOB_GRANULE + sizeof(uint32_t));
+    uintptr_t data = (uintptr_t)start + heap->metaOff +
+                     granules * sizeof(uint32_t) + OOB_GRANULE - 1;
+    data &= ~(uintptr_t)(OOB_GRANULE - 1);
+    heap->startOff = data - (uintptr_t)start;
+    heap->maxOff = heap->startOff + granules * OOB_GRANULE;
+    // Entries of granules no block starts at must read 0
+    if (!(flags & HEAP_FRESH))
+      memset(start + heap->metaOff, 0, granules * sizeof(uint32_t));
+  }
+  // No blocks yet --> heapEnd starts at heapStart
+  heap->endOff = heap->startOff;
+  heap->dirtyOff = heap->startOff;
+  // Growable heaps commit their top later (top_extend)
+  heap->topOff = heap->maxOff;
+  heap->mapSize = size;
+  heap->rootOff = 0;
+  heap->flags = flags;
+  memset(heap->fastBins, 0, sizeof(heap->fastBins));
+  heap->fastMax = tunable(MYMALLOPT_FAST_MAX);
+  heap->growStep = grow_step();
+  heap->agedAt = 0;
+  heap->largeMin = tunable(MYMALLOPT_LARGE_THRESHOLD);
+  heap->large = NULL;
+  heap->largeCount = heap->largeBytes = 0;
+  heap->largeMaxCount = heap->largeMaxBytes = 0;
+  heap->freeSizes = NULL;
+  heap->freeOffs = NULL;
+  heap->freeCount = 0;
+  heap->freeCap = 0;
+  // Shared heaps get a process-shared lock once their file is formatted
+  if ((flags & MYHEAP_MAINTAINED) && !(flags & MYHEAP_SHARED))
+    pthread_mutex_init(&heap->lock, NULL);
+  // File backed heaps publish the superblock once their lock is ready
+  heap->version = HEAP_VERSION;
+  heap->magic = (flags & HEAP_MAPPED) && !(flags & HEAP_FRESH) ? 0 : HEAP_MAGIC;
+  HEAP_PROBE2(init, heap, size);
+  return heap;
+}
+
+// Faults [from, to) in without changing its contents, which the heap's
+// owner may be writing to at the same time
+static void prefault_pages(char *from, char *to) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  from -= (uintptr_t)from % page;
+#ifdef MADV_POPULATE_WRITE // Linux 5.14
+  if (madvise(from, to - from, MADV_POPULATE_WRITE) == 0)
+    return;
+#endif
+  for (char *p = from; p < to; p += page)
+    __atomic_fetch_add(p, 0, __ATOMIC_RELAXED);
+}
+
+// Makes [from, to) of a reserved region usable. MYHEAP_POPULATE faults it
+// in right away (maps it again with MAP_POPULATE where there is one),
+// MYHEAP_MLOCK also keeps it resident. Returns -1 if either fails.
+static int region_commit(char *from, char *to, int flags) {
+  if ((flags & MYHEAP_POPULATE) && MAP_POPULATE != 0) {
+    if (mmap(from, to - from, PROT_READ | PROT_WRITE,
+             MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED | MAP_POPULATE, -1,
+             0) == MAP_FAILED)
+      return -1;
+  } else if (mprotect(from, to - from, PROT_READ | PROT_WRITE) != 0) {
+    return -1;
+  } else if (flags & MYHEAP_POPULATE) {
+    prefault_pages(from, to);
+  }
+  if ((flags & MYHEAP_MLOCK) && mlock(from, to - from) != 0) {
+    mprotect(from, to - from, PROT_NONE);
+    return -1;
+  }
+  return 0;
+}
+
+// Commits the region up to at least endOff (rounded up to growStep),
+// growing the top chunk in place. Returns -1 past heapMax.
+static int top_extend(myHeap *heap, size_t endOff) {
+  if (endOff <= heap->topOff)
+    return 0;
+  if (!(heap->flags & HEAP_GROWABLE) || endOff > heap->maxOff)
+    return -1;
+  size_t newTop = (endOff + heap->growStep - 1) / heap->growStep *
+                  heap->growStep;
+  if (newTop > heap->maxOff)
+    newTop = heap->maxOff;
+  if (region_commit((char *)heap + heap->topOff, (char *)heap + newTop,
+                    heap->flags) != 0)
+    return -1;
+  HEAP_PROBE3(grow, heap, newTop - heap->topOff, newTop);
+  heap->topOff = newTop;
+  return 0;
+}
+
+/**
+ * MYHEAP_PREFAULT: once the top chunk runs below a grow step, the
+ * allocating thread commits the next step (an mprotect, no page faults)
+ * and queues it for the prefault thread, which faults it in while the
+ * allocator carries on. The allocator never waits for prefaultLock: when
+ * it is busy that step is just not prefaulted. The thread holds the lock
+ * while it faults a chunk in, so prefault_drop (before a trim or destroy)
+ * also waits for the chunk in flight. The lock nests inside heap locks and
+ * the thread takes no other lock.
+ */
+#define PREFAULT_QUEUE 16
+#define PREFAULT_CHUNK (64 << 10)
+
+static struct prefault {
+  myHeap *heap; // NULL: free slot
+  char *from, *to;
+} prefaults[PREFAULT_QUEUE];
+static pthread_mutex_t prefaultLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefaultWake = PTHREAD_COND_INITIALIZER;
+static int prefaultRunning, prefaultHooked;
+
+static void *prefault_main(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&prefaultLock);
+  for (;;) {
+    struct prefault *next = NULL;
+    for (int i = 0; next == NULL && i < PREFAULT_QUEUE; i++) {
+      if (prefaults[i].heap != NULL)
+        next = &prefaults[i];
+    }
+    if (next == NULL) {
+      pthread_cond_wait(&prefaultWake, &prefaultLock);
+      continue;
+    }
+    // A chunk at a time, giving the CPU back in between: on a busy core
+    // the allocator must not wait for a whole grow step
+    char *end = next->to - next->from > PREFAULT_CHUNK
+                    ? next->from + PREFAULT_CHUNK
+                    : next->to;
+    prefault_pages(next->from, end);
+    next->from = end;
+    if (end == next->to)
+      next->heap = NULL;
+    pthread_mutex_unlock(&prefaultLock);
+    sched_yield();
+    pthread_mutex_lock(&prefaultLock);
+  }
+  return NULL;
+}
+
+// The thread is gone in the child, and may have held the lock at fork
+static void prefault_child(void) {
+  memset(prefaults, 0, sizeof(prefaults));
+  prefaultRunning = 0;
+  pthread_mutex_init(&prefaultLock, NULL);
+  pthread_cond_init(&prefaultWake, NULL);
+}
+
+// Queues [from, to) of heap, starting the thread if need be
+static void prefault_queue(myHeap *heap, char *from, char *to) {
+  if (pthread_mutex_trylock(&prefaultLock) != 0)
+    return;
+  if (!prefaultRunning) {
+    if (!prefaultHooked) {
+      pthread_atfork(NULL, NULL, prefault_child);
+      prefaultHooked = 1;
+    }
+    pthread_t thread;
+    prefaultRunning = pthread_create(&thread, NULL, prefault_main, NULL) == 0;
+    if (prefaultRunning)
+      pthread_detach(thread);
+  }
+  for (int i = 0; prefaultRunning && i < PREFAULT_QUEUE; i++) {
+    if (prefaults[i].heap == NULL) {
+      prefaults[i] = (struct prefault){heap, from, to};
+      pthread_cond_signal(&prefaultWake);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&prefaultLock);
+}
+
+// Forgets heap's queued ranges, waiting for one being faulted in
+static void prefault_drop(myHeap *heap) {
+  if (!(heap->flags & MYHEAP_PREFAULT))
+    return;
+  pthread_mutex_lock(&prefaultLock);
+  for (int i = 0; i < PREFAULT_QUEUE; i++) {
+    if (prefaults[i].heap == heap)
+      prefaults[i].heap = NULL;
+  }
+  pthread_mutex_unlock(&prefaultLock);
+}
+
+// Commits the next grow step ahead of need and has it prefaulted
+static void top_prefault(myHeap *heap) {
+  size_t from = heap->topOff;
+  if (top_extend(heap, from + 1) == 0)
+    prefault_queue(heap, (char *)heap + from, (char *)heap + heap->topOff);
+}
+
+myHeap *myHeapCreate(void *buffer, size_t size, int flags) {
   last_error = ERR_NONE;
+  // A private heap has no other process to share its lock with
+  flags &= ~MYHEAP_SHARED;
 
-  if (size == 0)
-    return alloc_error(ERR_OUT_OF_MEM, "Cannot allocate 0 bytes");
+  if (buffer != NULL)
+    return heap_init(buffer, size, flags);
 
-  // Add memory alignment
-  size_t alignedSize = ALIGN(size);
-  struct header *h;
+  // Reserve the whole region as the heap, but commit only what the heap
+  // struct needs; the top chunk commits the rest on demand
+  buffer = mmap(NULL, size, PROT_NONE,
+                MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  if (buffer == MAP_FAILED)
+    return alloc_error(ERR_MMAP_FAILED, strerror(errno));
+  size_t first = size < grow_step() ? size : grow_step();
+  if (region_commit(buffer, (char *)buffer + first, flags) != 0) {
+    munmap(buffer, size);
+    return alloc_error(ERR_MMAP_FAILED, strerror(errno));
+  }
 
-  // If the heap is not initialised
-  if (heapStart == NULL) {
-    // Allocate a block of memory via mmap and treat it as the heap.
-    heapStart = mmap(NULL, HEAP_SIZE, PROT_READ | PROT_WRITE,
-                     MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-    if (heapStart == MAP_FAILED) {
-      return alloc_error(ERR_MMAP_FAILED, strerror(errno));
+  myHeap *heap = heap_init(buffer, size,
+                           flags | HEAP_MAPPED | HEAP_FRESH | HEAP_GROWABLE);
+  if (heap == NULL) {
+    munmap(buffer, size);
+    return NULL;
+  }
+  // Out-of-band metadata is committed in full up front
+  if (first < heap->maxOff)
+    heap->topOff = first;
+  if (top_extend(heap, heap->startOff) != 0) {
+    munmap(buffer, size);
+    return alloc_error(ERR_MMAP_FAILED, strerror(errno));
+  }
+  if (flags & MYHEAP_PREFAULT)
+    prefault_queue(heap, HEAP_START(heap), (char *)heap + heap->topOff);
+  return heap;
+}
+
+// Sizes the file behind fd and formats it as an empty heap
+static myHeap *heap_format(int fd, size_t size, int flags) {
+  if (ftruncate(fd, size) != 0)
+    return alloc_error(ERR_MMAP_FAILED, strerror(errno));
+  void *region =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (region == MAP_FAILED)
+    return alloc_error(ERR_MMAP_FAILED, strerror(errno));
+
+  // The file may hold stale data, so it never counts as HEAP_FRESH. The
+  // free index would point into this process only.
+  flags &= ~MYHEAP_FREE_INDEX;
+  myHeap *heap = heap_init(region, size, flags | HEAP_MAPPED);
+  if (heap == NULL) {
+    munmap(region, size);
+    return NULL;
+  }
+
+  if (flags & MYHEAP_SHARED) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef __linux__
+    // If a process dies holding the lock, the next locker is told so
+    // instead of blocking forever
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+    pthread_mutex_init(&heap->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+  }
+
+  // Publish last: attach refuses a heap whose setup did not finish
+  heap->magic = HEAP_MAGIC;
+  return heap;
+}
+
+// Maps the heap already formatted in the file behind fd
+static myHeap *heap_map(int fd, size_t size) {
+  if (size < sizeof(myHeap))
+    return alloc_error(ERR_BAD_HEAP, "File holds no heap");
+
+  void *region =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (region == MAP_FAILED)
+    return alloc_error(ERR_MMAP_FAILED, strerror(errno));
+
+  myHeap *heap = (myHeap *)region;
+  if (heap->magic != HEAP_MAGIC || heap->version != HEAP_VERSION ||
+      heap->mapSize != size) {
+    munmap(region, size);
+    return alloc_error(ERR_BAD_HEAP, "File holds no heap");
+  }
+  // A private heap's lock was the last process's, maybe left held
+  if ((heap->flags & MYHEAP_MAINTAINED) && !(heap->flags & MYHEAP_SHARED))
+    pthread_mutex_init(&heap->lock, NULL);
+  HEAP_PROBE2(init, heap, size);
+  return heap;
+}
+
+myHeap *myHeapCreateShared(int fd, size_t size, int flags) {
+  last_error = ERR_NONE;
+  return heap_format(fd, size, flags | MYHEAP_SHARED);
+}
+
+myHeap *myHeapAttach(int fd) {
+  last_error = ERR_NONE;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return alloc_error(ERR_MMAP_FAILED, strerror(errno));
+  return heap_map(fd, st.st_size);
+}
+
+myHeap *myHeapOpenFile(const char *path, size_t size, int flags) {
+  last_error = ERR_NONE;
+
+  int fd = open(path, O_RDWR | O_CREAT, 0600);
+  if (fd < 0)
+    return alloc_error(ERR_MMAP_FAILED, strerror(errno));
+
+  struct stat st;
+  myHeap *heap;
+  if (fstat(fd, &st) != 0)
+    heap = alloc_error(ERR_MMAP_FAILED, strerror(errno));
+  else if (st.st_size == 0)
+    heap = heap_format(fd, size, flags | MYHEAP_PERSISTENT);
+  else
+    // Never format over a file that is not ours, only reopen it
+    heap = heap_map(fd, st.st_size);
+
+  // The mapping keeps the file alive
+  close(fd);
+  return heap;
+}
+
+int myHeapSync(myHeap *heap) {
+  if (msync(heap, heap->mapSize, MS_SYNC) != 0) {
+    last_error = ERR_MMAP_FAILED;
+    return -1;
+  }
+  return 0;
+}
+
+void myHeapSetRoot(myHeap *heap, void *p) {
+  heap->rootOff = p ? myHeapOffset(heap, p) : 0;
+}
+
+void *myHeapGetRoot(myHeap *heap) {
+  return heap->rootOff ? myHeapPointer(heap, heap->rootOff) : NULL;
+}
+
+size_t myHeapOffset(myHeap *heap, void *p) {
+  return (char *)p - (char *)heap;
+}
+
+void *myHeapPointer(myHeap *heap, size_t offset) {
+  return (char *)heap + offset;
+}
+
+static void heap_lock(myHeap *heap) {
+  if (!(heap->flags & (MYHEAP_SHARED | MYHEAP_MAINTAINED)))
+    return;
+#ifdef __linux__
+  // The previous owner died in the middle of an alloc or free. Both only
+  // publish a block after its header is written (heapEnd moves last), so
+  // the chain is still walkable and the heap can be used as is. With
+  // out-of-band metadata a merge likewise writes the merged block's entry
+  // before it clears the absorbed ones, and heapEnd retreats before the
+  // entry of a block given back to the top is cleared: a walk never meets
+  // a zero entry, which would not advance it.
+  if (pthread_mutex_lock(&heap->lock) == EOWNERDEAD)
+    pthread_mutex_consistent(&heap->lock);
+#else
+  pthread_mutex_lock(&heap->lock);
+#endif
+}
+
+static void heap_unlock(myHeap *heap) {
+  if (heap->flags & (MYHEAP_SHARED | MYHEAP_MAINTAINED))
+    pthread_mutex_unlock(&heap->lock);
+}
+
+#define INDEX_MIN_CAP 1024 // entries in the first index mapping
+
+static uint32_t index_size(size_t size) {
+  return size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+}
+
+static size_t index_bytes(size_t cap) {
+  return cap * (sizeof(uint32_t) + sizeof(size_t));
+}
+
+// Drops the index: searches walk the blocks again
+static void index_disable(myHeap *heap) {
+  if (heap->freeSizes != NULL)
+    munmap(heap->freeSizes, index_bytes(heap->freeCap));
+  heap->freeSizes = NULL;
+  heap->freeOffs = NULL;
+  heap->freeCount = 0;
+  heap->freeCap = 0;
+  heap->flags &= ~MYHEAP_FREE_INDEX;
+}
+
+// Doubles the index. Mapped directly: the heap may be behind malloc itself.
+static int index_grow(myHeap *heap) {
+  size_t cap = heap->freeCap ? 2 * heap->freeCap : INDEX_MIN_CAP;
+  void *m = mmap(NULL, index_bytes(cap), PROT_READ | PROT_WRITE,
+                 MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (m == MAP_FAILED)
+    return -1;
+  uint32_t *sizes = (uint32_t *)m;
+  size_t *offs = (size_t *)(sizes + cap); // cap is even: stays aligned
+  if (heap->freeSizes != NULL) {
+    memcpy(sizes, heap->freeSizes, heap->freeCount * sizeof(*sizes));
+    memcpy(offs, heap->freeOffs, heap->freeCount * sizeof(*offs));
+    munmap(heap->freeSizes, index_bytes(heap->freeCap));
+  }
+  heap->freeSizes = sizes;
+  heap->freeOffs = offs;
+  heap->freeCap = cap;
+  return 0;
+}
+
+// Position of the first entry at or after offset off
+static size_t index_position(myHeap *heap, size_t off) {
+  size_t lo = 0, hi = heap->freeCount;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (heap->freeOffs[mid] < off)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Block b of size bytes just became free
+static void index_insert(myHeap *heap, char *b, size_t size) {
+  if (heap->freeCount == heap->freeCap && index_grow(heap) != 0) {
+    index_disable(heap);
+    return;
+  }
+  size_t off = b - (char *)heap;
+  size_t i = index_position(heap, off);
+  size_t tail = heap->freeCount - i;
+  memmove(heap->freeSizes + i + 1, heap->freeSizes + i,
+          tail * sizeof(*heap->freeSizes));
+  memmove(heap->freeOffs + i + 1, heap->freeOffs + i,
+          tail * sizeof(*heap->freeOffs));
+  heap->freeSizes[i] = index_size(size);
+  heap->freeOffs[i] = off;
+  heap->freeCount++;
+}
+
+// Free block b is being reused
+static void index_remove(myHeap *heap, char *b) {
+  size_t i = index_position(heap, b - (char *)heap);
+  size_t tail = heap->freeCount - i - 1;
+  memmove(heap->freeSizes + i, heap->freeSizes + i + 1,
+          tail * sizeof(*heap->freeSizes));
+  memmove(heap->freeOffs + i, heap->freeOffs + i + 1,
+          tail * sizeof(*heap->freeOffs));
+  heap->freeCount--;
+}
+
+// First free block with at least alignedSize bytes, NULL if none
+static char *find_fit(myHeap *heap, size_t alignedSize) {
+  char *heapEnd = HEAP_END(heap);
+
+  if (heap->flags & MYHEAP_FREE_INDEX) {
+    uint32_t need = index_size(alignedSize);
+    size_t i = 0;
+    while ((i += sizeScanFirst(heap->freeSizes + i, heap->freeCount - i,
+                               need)) < heap->freeCount) {
+      // Only a saturated entry can be too small after all
+      char *b = (char *)heap + heap->freeOffs[i];
+      if (GET_SIZE(block_meta(heap, b)) >= alignedSize)
+        return b;
+      i++;
     }
+    return NULL;
+  }
 
-    printf("mmap succeeded, heapStart = %p\n", heapStart);
-    // mmap() returns a pointer to the mapped region --> set the heapend
-    heapEnd = heapStart;
-    heapMax = (char *)heapStart + HEAP_SIZE;
+  if (OOB_META(heap)) {
+    // Scan the entries alone; payload pages are never touched
+    uint32_t *first = oob_entry(heap, HEAP_START(heap));
+    uint32_t *end = oob_entry(heap, heapEnd);
+    size_t need = alignedSize / OOB_GRANULE;
+    for (uint32_t *e = first; e < end; e += *e >> 2) {
+      if ((*e & 1) && (*e >> 2) >= need)
+        return HEAP_START(heap) + (e - first) * OOB_GRANULE;
+    }
+    return NULL;
   }
+
   // Iterate from the beginning of the heap, checking each header.
-  void *p = heapStart;
+  char *p = HEAP_START(heap);
   while (p < heapEnd) {
-    // Cast the header pointer to the current pointer
-    h = (struct header *)p;
-    // If a block is free and the h->size >= size, reuse that block.
-    if (IS_FREE(h) && GET_SIZE(h) >= alignedSize) {
-      MARK_ALLOCATED(h);
-      // Return a pointer to the usable memory block,
-      // which is right after the header (h + 1).
-      return (void *)(h + 1);
-    }
+    struct header *h = (struct header *)p;
+    // If a block is free and its size >= size, reuse that block.
+    if (IS_FREE(h->meta_data) && GET_SIZE(h->meta_data) >= alignedSize)
+      // The usable memory is right after the header (h + 1)
+      return (char *)(h + 1);
     // If no such blocks, move to the next block.
-    p += sizeof(struct header) + GET_SIZE(h);
+    p += sizeof(struct header) + GET_SIZE(h->meta_data);
   }
+  return NULL;
+}
 
-  // Allocate at heap end
-  if ((char *)heapEnd + sizeof(struct header) + alignedSize > (char *)heapMax) {
+// Gives free block b, which ends on heapEnd, back to the top chunk. The
+// list cannot step back to the block before b; the free index can, so free
+// blocks it lists right below the top are returned as well.
+static void top_absorb(myHeap *heap, char *b) {
+  // heapEnd moves before the entry goes (see heap_lock)
+  heap->endOff = b - BLOCK_OVERHEAD(heap) - (char *)heap;
+  if (OOB_META(heap))
+    *oob_entry(heap, b) = 0;
+  while ((heap->flags & MYHEAP_FREE_INDEX) && heap->freeCount > 0) {
+    char *prev = (char *)heap + heap->freeOffs[heap->freeCount - 1];
+    if (prev + GET_SIZE(block_meta(heap, prev)) != HEAP_END(heap))
+      break;
+    heap->freeCount--;
+    heap->endOff = prev - BLOCK_OVERHEAD(heap) - (char *)heap;
+    if (OOB_META(heap))
+      *oob_entry(heap, prev) = 0;
+  }
+}
+
+// MYHEAP_ZERO for size bytes at b, just carved off the top chunk: caller
+// buffers may hold stale data, fresh mappings are zero above dirtyOff
+static void top_zero(myHeap *heap, char *b, size_t size) {
+  if (heap->flags & MYHEAP_ZERO) {
+    char *dirty = (char *)heap + heap->dirtyOff;
+    if (!(heap->flags & HEAP_FRESH))
+      memset(b, 0, size);
+    else if (b < dirty)
+      memset(b, 0, (b + size < dirty ? b + size : dirty) - b);
+  }
+  if (heap->endOff > heap->dirtyOff)
+    heap->dirtyOff = heap->endOff;
+}
+
+// Smallest payload a block split off another one may have
+static size_t min_block(myHeap *heap) {
+  return OOB_META(heap) ? OOB_GRANULE : ALIGNMENT;
+}
+
+// Merges the free blocks that follow b into b and returns b's new size.
+// unindex: the absorbed blocks are still in the free index.
+static size_t coalesce_next(myHeap *heap, char *b, size_t size,
+                            int unindex) {
+  size_t overhead = BLOCK_OVERHEAD(heap);
+  size_t merged = size;
+  for (char *next = b + size + overhead; next < HEAP_END(heap);
+       next = b + size + overhead) {
+    size_t meta = block_meta(heap, next);
+    if (!IS_FREE(meta))
+      break;
+    if (unindex && (heap->flags & MYHEAP_FREE_INDEX))
+      index_remove(heap, next);
+    size += overhead + GET_SIZE(meta);
+  }
+  if (size == merged)
+    return size;
+  // Only block starts may have an entry. b covers the absorbed blocks
+  // before their entries go, so a walk never meets a zero entry (see
+  // heap_lock).
+  if (OOB_META(heap)) {
+    block_set_meta(heap, b, MARK_FREE(size));
+    for (char *next = b + merged; next < b + size;) {
+      uint32_t *e = oob_entry(heap, next);
+      next += GET_SIZE(block_meta(heap, next));
+      *e = 0;
+    }
+  }
+  HEAP_PROBE2(coalesce, heap, size);
+  return size;
+}
+
+// Takes free block b for a request of alignedSize bytes; the tail it does
+// not need becomes a free block when it can hold one
+static size_t take_block(myHeap *heap, char *b, size_t alignedSize) {
+  size_t size = GET_SIZE(block_meta(heap, b));
+  size_t overhead = BLOCK_OVERHEAD(heap);
+  if (heap->flags & MYHEAP_FREE_INDEX)
+    index_remove(heap, b);
+  if (size >= alignedSize + overhead + min_block(heap)) {
+    char *rest = b + alignedSize + overhead;
+    size_t restSize = size - alignedSize - overhead;
+    block_set_meta(heap, rest, MARK_FREE(restSize));
+    if (heap->flags & MYHEAP_FREE_INDEX)
+      index_insert(heap, rest, restSize);
+    size = alignedSize;
+  }
+  block_set_meta(heap, b, MARK_ALLOCATED(size));
+  return size;
+}
+
+// Bin of a block of size bytes, -1 when it is too large for one
+static int fast_bin(myHeap *heap, size_t size) {
+  if (!(heap->flags & MYHEAP_FAST_BINS) || size > heap->fastMax)
+    return -1;
+  return size / ALIGNMENT;
+}
+
+// The link to the next block in a bin sits in the payload, as an offset
+static size_t fast_next(myHeap *heap, size_t off) {
+  size_t next;
+  memcpy(&next, (char *)heap + off, sizeof(next));
+  return next;
+}
+
+// Empties the fast bins and merges every run of free blocks
+static void consolidate(myHeap *heap) {
+  for (int i = 0; i < FAST_BINS; i++) {
+    // Unlink the bin first: a process dying in here (shared heaps) leaks
+    // the rest of the bin instead of leaving free blocks in it
+    size_t off = heap->fastBins[i];
+    heap->fastBins[i] = 0;
+    while (off != 0) {
+      char *b = (char *)heap + off;
+      off = fast_next(heap, off);
+      block_set_meta(heap, b, MARK_FREE(block_meta(heap, b)));
+    }
+  }
+  // Blocks go back into the index in address order as the walk meets them
+  if (heap->flags & MYHEAP_FREE_INDEX)
+    heap->freeCount = 0;
+  for (char *b = block_first(heap); b < HEAP_END(heap);) {
+    size_t meta = block_meta(heap, b);
+    if (IS_FREE(meta)) {
+      meta = MARK_FREE(coalesce_next(heap, b, GET_SIZE(meta), 0));
+      if (block_next(heap, b, meta) - BLOCK_OVERHEAD(heap) == HEAP_END(heap)) {
+        top_absorb(heap, b);
+        break;
+      }
+      block_set_meta(heap, b, meta);
+      if (heap->flags & MYHEAP_FREE_INDEX)
+        index_insert(heap, b, GET_SIZE(meta));
+    }
+    b = block_next(heap, b, meta);
+  }
+}
+
+static void fast_bin_totals(myHeap *heap, size_t *blocks, size_t *bytes) {
+  *blocks = *bytes = 0;
+  for (int i = 0; i < FAST_BINS; i++) {
+    for (size_t off = heap->fastBins[i]; off != 0; off = fast_next(heap, off)) {
+      (*blocks)++;
+      *bytes += (size_t)i * ALIGNMENT;
+    }
+  }
+}
+
+static int fast_bins_empty(myHeap *heap) {
+  for (int i = 0; i < FAST_BINS; i++) {
+    if (heap->fastBins[i] != 0)
+      return 0;
+  }
+  return 1;
+}
+
+// *slow is set when the request could not reuse a block
+static void *heap_alloc(myHeap *heap, size_t size, int *slow) {
+  if (size == 0)
+    return alloc_error(ERR_OUT_OF_MEM, "Cannot allocate 0 bytes");
+
+  // Add memory alignment
+  size_t alignedSize = block_size(heap, size);
+
+  // An exact fit from a fast bin needs no search at all
+  int bin = alignedSize != 0 ? fast_bin(heap, alignedSize) : -1;
+  if (bin >= 0 && heap->fastBins[bin] != 0) {
+    char *b = (char *)heap + heap->fastBins[bin];
+    heap->fastBins[bin] = fast_next(heap, heap->fastBins[bin]);
+    if (heap->flags & MYHEAP_ZERO)
+      memset(b, 0, alignedSize);
+    return b;
+  }
+
+  char *b = alignedSize != 0 ? find_fit(heap, alignedSize) : NULL;
+  if (b == NULL && alignedSize != 0 && !fast_bins_empty(heap) &&
+      heap->topOff - heap->endOff < BLOCK_OVERHEAD(heap) + alignedSize) {
+    // The blocks parked in fast bins may merge into one that fits; a top
+    // chunk with room committed already is cheaper than the walk. The
+    // pass touches the whole heap, so this is the slow path whatever it
+    // finds.
+    consolidate(heap);
+    *slow = 1;
+    b = find_fit(heap, alignedSize);
+  }
+  if (b != NULL) {
+    size_t taken = take_block(heap, b, alignedSize);
+    if (heap->flags & MYHEAP_ZERO)
+      memset(b, 0, taken);
+    return b;
+  }
+  *slow = 1;
+
+  // Carve the block off the top chunk, committing more of it if needed
+  // (consolidating may have just grown the top)
+  char *heapEnd = HEAP_END(heap);
+  size_t overhead = BLOCK_OVERHEAD(heap);
+  size_t avail = HEAP_MAX(heap) - heapEnd;
+  if (alignedSize == 0 || alignedSize > avail ||
+      avail - alignedSize < overhead ||
+      top_extend(heap, heap->endOff + overhead + alignedSize) != 0) {
+    HEAP_PROBE2(oom, heap, size);
     return alloc_error(ERR_OUT_OF_MEM, "Heap out of memory");
   }
 
-  h = (struct header *)heapEnd;
-  SET_SIZE(h, alignedSize);
-  MARK_ALLOCATED(h);
-  // Progress the heapEnd by the size of the header +
-  // the size of the block we're allocating
-  // - h + 1: skips past the header (struct header)
-  // - size: advances by the size of the block being allocated.
-  heapEnd = (void *)(h + 1) + alignedSize;
-  // Return a pointer to the usable memory block,
-  // which is right after the header (h + 1).
-  return (void *)(h + 1);
+  // The payload starts right after its header (h + 1), or right at
+  // heapEnd when the metadata lives out of band
+  b = heapEnd + overhead;
+  block_set_meta(heap, b, MARK_ALLOCATED(alignedSize));
+  // Progress the heapEnd past the block we're allocating
+  heap->endOff = b + alignedSize - (char *)heap;
+  top_zero(heap, b, alignedSize);
+  if ((heap->flags & MYHEAP_PREFAULT) &&
+      heap->topOff - heap->endOff < heap->growStep)
+    top_prefault(heap);
+  return b;
 }
 
-void myFree(void *p) {
+// Mapping bytes that hold the header and size payload bytes
+static size_t large_span(size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  return (LARGE_HEADER + size + page - 1) / page * page;
+}
+
+#define LARGE_PAYLOAD(lo) ((char *)(lo) + LARGE_HEADER)
+
+// Records the large objects' high-water marks. The heap must be locked.
+static void large_peak(myHeap *heap) {
+  if (heap->largeCount > heap->largeMaxCount)
+    heap->largeMaxCount = heap->largeCount;
+  if (heap->largeBytes > heap->largeMaxBytes)
+    heap->largeMaxBytes = heap->largeBytes;
+}
+
+// Maps a large object of size bytes with room for maxSize and links it
+// into the heap. Returns NULL, without reporting, if that fails.
+static void *large_alloc(myHeap *heap, size_t size, size_t maxSize) {
+  if (maxSize > HEAP_SIZE_MAX)
+    return NULL;
+  size_t reserved = large_span(maxSize), committed = large_span(size);
+  char *m = mmap(NULL, reserved, PROT_NONE,
+                 MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  if (m == MAP_FAILED)
+    return NULL;
+  if (region_commit(m, m + committed, heap->flags) != 0) {
+    munmap(m, reserved);
+    return NULL;
+  }
+  HEAP_PROBE3(grow, heap, committed, committed);
+  struct largeObject *lo = (struct largeObject *)m;
+  lo->size = size;
+  lo->committed = committed;
+  lo->reserved = reserved;
+  lo->sampled = 0;
+  heap_lock(heap);
+  lo->prev = NULL;
+  lo->next = heap->large;
+  if (heap->large != NULL)
+    heap->large->prev = lo;
+  heap->large = lo;
+  heap->largeCount++;
+  heap->largeBytes += committed;
+  large_peak(heap);
+  heap_unlock(heap);
+  return LARGE_PAYLOAD(lo);
+}
+
+// The large object whose payload is p, NULL if there is none. The heap
+// must be locked.
+static struct largeObject *large_find(myHeap *heap, void *p) {
+  for (struct largeObject *lo = heap->large; lo != NULL; lo = lo->next) {
+    if (LARGE_PAYLOAD(lo) == (char *)p)
+      return lo;
+  }
+  return NULL;
+}
+
+static void large_unlink(myHeap *heap, struct largeObject *lo) {
+  if (lo->prev != NULL)
+    lo->prev->next = lo->next;
+  else
+    heap->large = lo->next;
+  if (lo->next != NULL)
+    lo->next->prev = lo->prev;
+  heap->largeCount--;
+  heap->largeBytes -= lo->committed;
+}
+
+// Resizes lo in place: commits the pages a larger size needs, releases
+// those a smaller one no longer does. Returns -1 past the reservation.
+// The heap must be locked.
+static int large_resize(myHeap *heap, struct largeObject *lo, size_t size) {
+  if (size > lo->reserved - LARGE_HEADER)
+    return -1;
+  char *m = (char *)lo;
+  size_t span = large_span(size);
+  if (span > lo->committed) {
+    if (region_commit(m + lo->committed, m + span, heap->flags) != 0)
+      return -1;
+    HEAP_PROBE3(grow, heap, span - lo->committed, span);
+  } else if (span < lo->committed) {
+    if (heap->flags & MYHEAP_MLOCK)
+      munlock(m + span, lo->committed - span);
+    madvise(m + span, lo->committed - span, MADV_DONTNEED);
+    mprotect(m + span, lo->committed - span, PROT_NONE);
+    HEAP_PROBE2(purge, heap, lo->committed - span);
+  }
+  // Newly committed pages are zero, the old tail may not be
+  if ((heap->flags & MYHEAP_ZERO) && size > lo->size) {
+    size_t dirty = lo->committed - LARGE_HEADER;
+    if (dirty > size)
+      dirty = size;
+    if (dirty > lo->size)
+      memset(LARGE_PAYLOAD(lo) + lo->size, 0, dirty - lo->size);
+  }
+  heap->largeBytes = heap->largeBytes - lo->committed + span;
+  lo->committed = span;
+  lo->size = size;
+  large_peak(heap);
+  return 0;
+}
+
+void *myHeapAlloc(myHeap *heap, size_t size) {
+  last_error = ERR_NONE;
+  // Rounding it up to ALIGNMENT would wrap around
+  if (size > SIZE_MAX - ALIGNMENT) {
+    HEAP_PROBE2(oom, heap, size);
+    return alloc_error(ERR_OUT_OF_MEM, "Heap out of memory");
+  }
+
+#ifdef HEAP_LATENCY
+  uint64_t start = latencyNow();
+#endif
+  int slow = 0;
+  void *p = NULL;
+  // A large object falls back to a block if it cannot be mapped
+  if (size >= heap->largeMin && (heap->flags & HEAP_GROWABLE)) {
+    p = large_alloc(heap, size, size);
+    slow = 1;
+  }
+  int sampled = 0;
+  if (p == NULL) {
+    heap_lock(heap);
+    p = heap_alloc(heap, size, &slow);
+#ifdef HEAP_PROFILER
+    // The flag lets the free skip the profiler for unsampled blocks. It
+    // shares the header with the aging bit and neighbours read it when
+    // they merge, so it is only written under the lock.
+    sampled = p != NULL && heapProfilerShouldSample(size);
+    if (sampled)
+      block_set_meta(heap, p, MARK_SAMPLED(block_meta(heap, p)));
+#endif
+    heap_unlock(heap);
+  } else {
+#ifdef HEAP_PROFILER
+    // Only the caller can free it, and walks of the list skip the flag
+    sampled = heapProfilerShouldSample(size);
+    ((struct largeObject *)((char *)p - LARGE_HEADER))->sampled = sampled;
+#endif
+  }
+#ifdef HEAP_LATENCY
+  latencyRecord(slow ? LAT_ALLOC_SLOW : LAT_ALLOC_FAST, latencyNow() - start);
+#endif
+#ifdef HEAP_PROFILER
+  if (sampled)
+    heapProfilerRecordAlloc(p, size);
+#else
+  (void)sampled;
+#endif
+  return p;
+}
+
+void *myHeapAllocGrowable(myHeap *heap, size_t size, size_t maxSize) {
+  last_error = ERR_NONE;
+  if (!(heap->flags & HEAP_GROWABLE))
+    return alloc_error(ERR_OUT_OF_MEM,
+                       "growable objects need a heap myHeapCreate mapped");
+  void *p = large_alloc(heap, size, maxSize < size ? size : maxSize);
+  if (p == NULL)
+    return alloc_error(ERR_MMAP_FAILED, "cannot reserve a growable object");
+  return p;
+}
+
+void myHeapFree(myHeap *heap, void *p) {
   last_error = ERR_NONE;
 
   if (p == NULL)
     return;
 
-  // Check if p is within heap bounds
-  if ((char *)p < (char *)heapStart + sizeof(struct header) ||
-      (char *)p >= (char *)heapEnd) {
-    free_error(ERR_INVALID_FREE, "invalid free pointer");
+#ifdef HEAP_LATENCY
+  uint64_t start = latencyNow();
+#endif
+  heap_lock(heap);
+  // Check if p is within heap bounds; out-of-band metadata also tells
+  // whether a block starts at p
+  char *b = (char *)p;
+  if (b < block_first(heap) || b >= HEAP_END(heap) ||
+      (OOB_META(heap) && ((b - HEAP_START(heap)) % OOB_GRANULE != 0 ||
+                          *oob_entry(heap, b) == 0))) {
+    // Not a block; it may still be a large object
+    struct largeObject *lo = large_find(heap, p);
+    if (lo != NULL)
+      large_unlink(heap, lo);
+    heap_unlock(heap);
+    if (lo == NULL) {
+      free_error(ERR_INVALID_FREE, "invalid free pointer");
+      return;
+    }
+#ifdef HEAP_PROFILER
+    if (lo->sampled)
+      heapProfilerRecordFree(p);
+#endif
+    HEAP_PROBE2(purge, heap, lo->committed);
+    munmap(lo, lo->reserved);
+#ifdef HEAP_LATENCY
+    latencyRecord(LAT_FREE_SLOW, latencyNow() - start);
+#endif
+    return;
+  }
+
+  // Look up the block's metadata (the header right before the payload
+  // pointer, or its entry)
+  size_t meta = block_meta(heap, b);
+  int bin = fast_bin(heap, GET_SIZE(meta));
+  size_t off = b - (char *)heap;
+  // A block still in a bin looks allocated; catch at least the common
+  // case of freeing the same block twice in a row
+  if (IS_FREE(meta) || (bin >= 0 && heap->fastBins[bin] == off)) {
+    heap_unlock(heap);
+    free_error(ERR_INVALID_FREE, "double free");
+    return;
+  }
+#ifdef HEAP_PROFILER
+  if (IS_SAMPLED(meta)) {
+    meta = CLEAR_SAMPLED(meta);
+    block_set_meta(heap, b, meta);
+    heapProfilerRecordFree(p);
+  }
+#endif
+
+  int slow = 0;
+  if (bin >= 0) {
+    // Park it, neighbours untouched
+    memcpy(b, &heap->fastBins[bin], sizeof(size_t));
+    heap->fastBins[bin] = off;
+  } else {
+    // Set it to free, merged with the free blocks after it; the last
+    // block goes back to the top chunk
+    size_t size = coalesce_next(heap, b, GET_SIZE(meta), 1);
+    slow = size != GET_SIZE(meta);
+    if (b + size == HEAP_END(heap)) {
+      top_absorb(heap, b);
+    } else {
+      block_set_meta(heap, b, MARK_FREE(size));
+      if (heap->flags & MYHEAP_FREE_INDEX)
+        index_insert(heap, b, size);
+    }
+  }
+  heap_unlock(heap);
+#ifdef HEAP_LATENCY
+  // Only frees that merged blocks count as slow
+  latencyRecord(slow ? LAT_FREE_SLOW : LAT_FREE_FAST, latencyNow() - start);
+#else
+  (void)slow;
+#endif
+}
+
+void *myHeapRealloc(myHeap *heap, void *p, size_t size) {
+  if (p == NULL)
+    return myHeapAlloc(heap, size);
+  if (size == 0) {
+    myHeapFree(heap, p);
+    return NULL;
+  }
+  if (size > SIZE_MAX - ALIGNMENT)
+    return alloc_error(ERR_OUT_OF_MEM, "Heap out of memory");
+
+  // A large object grows or shrinks within its reservation, in place
+  if (((char *)p < (char *)heap || (char *)p >= HEAP_MAX(heap)) &&
+      (heap->flags & HEAP_GROWABLE)) {
+    heap_lock(heap);
+    struct largeObject *lo = large_find(heap, p);
+    if (lo == NULL) {
+      heap_unlock(heap);
+      free_error(ERR_INVALID_FREE, "invalid realloc pointer");
+      return NULL;
+    }
+    size_t oldSize = lo->size;
+    int resized = large_resize(heap, lo, size) == 0;
+    heap_unlock(heap);
+    if (resized)
+      return p;
+    void *q = myHeapAlloc(heap, size);
+    if (q == NULL)
+      return NULL;
+    memcpy(q, p, oldSize);
+    myHeapFree(heap, p);
+    return q;
+  }
+
+  // The caller owns the block, so its size cannot change under us
+  size_t oldSize = GET_SIZE(block_meta(heap, p));
+  // Alignment slack or a reused larger block may already have room
+  if (size <= oldSize)
+    return p;
+
+  // The last block grows into the top chunk where it is
+  heap_lock(heap);
+  char *b = (char *)p;
+  size_t newSize = block_size(heap, size);
+  if (newSize != 0 && b + oldSize == HEAP_END(heap) &&
+      newSize - oldSize <= (size_t)(HEAP_MAX(heap) - HEAP_END(heap)) &&
+      top_extend(heap, b + newSize - (char *)heap) == 0) {
+    size_t meta = block_meta(heap, b);
+    block_set_meta(heap, b, newSize | (meta & FLAG_BITS));
+    heap->endOff = b + newSize - (char *)heap;
+    top_zero(heap, b + oldSize, newSize - oldSize);
+    heap_unlock(heap);
+    return p;
+  }
+  heap_unlock(heap);
+
+  void *q = myHeapAlloc(heap, size);
+  if (q == NULL)
+    return NULL;
+  memcpy(q, p, oldSize);
+  myHeapFree(heap, p);
+  return q;
+}
+
+static int check_error(const char *msg, const void *where) {
+  fprintf(stderr, "Heap check failed at %p: %s\n", where, msg);
+  return -1;
+}
+
+int myHeapCheck(myHeap *heap) {
+  int rc = 0;
+  heap_lock(heap);
+  if (heap->magic != HEAP_MAGIC)
+    rc = check_error("bad magic", heap);
+  else if (heap->startOff % ALIGNMENT != 0 ||
+           heap->startOff > heap->endOff || heap->endOff > heap->topOff ||
+           heap->topOff > heap->maxOff)
+    rc = check_error("heapStart/heapEnd/heapMax out of order", heap);
+
+  // Every header must lead exactly to the next one and the last block
+  // must end on heapEnd. The free index must list exactly the free blocks.
+  char *b = block_first(heap);
+  size_t indexed = 0;
+  while (rc == 0 && b < HEAP_END(heap)) {
+    size_t meta = block_meta(heap, b);
+    if ((heap->flags & MYHEAP_FREE_INDEX) && IS_FREE(meta)) {
+      if (indexed == heap->freeCount ||
+          heap->freeOffs[indexed] != (size_t)(b - (char *)heap) ||
+          heap->freeSizes[indexed] != index_size(GET_SIZE(meta)))
+        rc = check_error("free block missing from the free index", b);
+      indexed++;
+    }
+    if (rc != 0)
+      break;
+    if (GET_SIZE(meta) == 0)
+      rc = check_error("empty block", b);
+    else if (meta & FLAG_BITS & ~(size_t)3)
+      rc = check_error("unknown header flag", b);
+    else if (OOB_META(heap)) {
+      // Only the granule a block starts at has an entry
+      for (size_t off = OOB_GRANULE; rc == 0 && off < GET_SIZE(meta);
+           off += OOB_GRANULE) {
+        if (*oob_entry(heap, b + off) != 0)
+          rc = check_error("stray metadata entry inside block", b + off);
+      }
+    }
+    b = block_next(heap, b, meta);
+  }
+  if (rc == 0 && b - BLOCK_OVERHEAD(heap) != HEAP_END(heap))
+    rc = check_error("last block overruns heapEnd", b);
+  if (rc == 0 && (heap->flags & MYHEAP_FREE_INDEX) &&
+      indexed != heap->freeCount)
+    rc = check_error("free index lists blocks that are not free", heap);
+  // Large objects: a well linked list (a cycle breaks a prev link) of
+  // objects that have their pages committed
+  for (struct largeObject *lo = heap->large, *prev = NULL;
+       rc == 0 && lo != NULL; prev = lo, lo = lo->next) {
+    if (lo->prev != prev)
+      rc = check_error("large object list is broken", lo);
+    else if (lo->committed != large_span(lo->size) ||
+             lo->committed > lo->reserved)
+      rc = check_error("large object committed size is off", lo);
+  }
+  // Binned blocks must be allocated blocks of their bin's size; a list
+  // longer than the heap has room for is a cycle
+  size_t maxBlocks = (heap->maxOff - heap->startOff) / ALIGNMENT;
+  for (int i = 0; rc == 0 && i < FAST_BINS; i++) {
+    size_t n = 0;
+    for (size_t off = heap->fastBins[i]; rc == 0 && off != 0;
+         off = fast_next(heap, off)) {
+      char *bb = (char *)heap + off;
+      if (bb < block_first(heap) || bb >= HEAP_END(heap))
+        rc = check_error("fast bin points outside the heap", bb);
+      else if (IS_FREE(block_meta(heap, bb)) ||
+               GET_SIZE(block_meta(heap, bb)) != (size_t)i * ALIGNMENT)
+        rc = check_error("fast bin holds a block of another size", bb);
+      else if (++n > maxBlocks)
+        rc = check_error("fast bin has a cycle", bb);
+    }
+  }
+  heap_unlock(heap);
+  return rc;
+}
+
+void myHeapGetStats(myHeap *heap, struct myHeapStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+
+  heap_lock(heap);
+  stats->mappedBytes = heap->topOff; // committed part
+  stats->usedBytes = heap->endOff - heap->startOff;
+  for (char *b = block_first(heap); b < HEAP_END(heap);) {
+    size_t meta = block_meta(heap, b);
+    if (IS_FREE(meta)) {
+      stats->freeBytes += GET_SIZE(meta);
+      stats->freeBlocks++;
+    } else {
+      stats->liveBytes += GET_SIZE(meta);
+      stats->liveBlocks++;
+    }
+    b = block_next(heap, b, meta);
+  }
+  // Binned blocks are marked allocated but free to the owner
+  size_t binnedBlocks, binnedBytes;
+  fast_bin_totals(heap, &binnedBlocks, &binnedBytes);
+  stats->liveBlocks -= binnedBlocks;
+  stats->liveBytes -= binnedBytes;
+  stats->freeBlocks += binnedBlocks;
+  stats->freeBytes += binnedBytes;
+  for (struct largeObject *lo = heap->large; lo != NULL; lo = lo->next) {
+    stats->mappedBytes += lo->committed;
+    stats->usedBytes += lo->committed;
+    stats->liveBytes += lo->size;
+    stats->liveBlocks++;
+  }
+  heap_unlock(heap);
+
+#ifdef HEAP_LATENCY
+  latencyPercentiles(LAT_ALLOC_FAST, &stats->allocFast);
+  latencyPercentiles(LAT_ALLOC_SLOW, &stats->allocSlow);
+  latencyPercentiles(LAT_FREE_FAST, &stats->freeFast);
+  latencyPercentiles(LAT_FREE_SLOW, &stats->freeSlow);
+#endif
+}
+
+#define REPORT_CLASSES 14 // 16 B, 32 B, ... 64 KiB, then everything larger
+#define REPORT_SITES 10
+
+struct reportClass {
+  size_t liveBlocks, liveBytes, freeBlocks, freeBytes;
+};
+
+// Smallest power of two >= size, starting at 16 bytes
+static int report_class(size_t size) {
+  int c = 0;
+  while (c < REPORT_CLASSES - 1 && size > ((size_t)16 << c))
+    c++;
+  return c;
+}
+
+#ifdef HEAP_PROFILER
+struct reportSite {
+  void *stack[HEAP_PROFILER_MAX_DEPTH];
+  int depth;
+  size_t objects, bytes;
+};
+
+// Keeps the REPORT_SITES sites with the most live bytes, largest first
+static void report_site(void *const *stack, int depth, size_t objects,
+                        size_t bytes, void *arg) {
+  struct reportSite *top = (struct reportSite *)arg;
+  int i = REPORT_SITES;
+  while (i > 0 && top[i - 1].bytes < bytes)
+    i--;
+  if (i == REPORT_SITES)
+    return;
+  memmove(&top[i + 1], &top[i], (REPORT_SITES - 1 - i) * sizeof(*top));
+  memcpy(top[i].stack, stack, depth * sizeof(void *));
+  top[i].depth = depth;
+  top[i].objects = objects;
+  top[i].bytes = bytes;
+}
+#endif
+
+void myHeapReport(myHeap *heap, FILE *out) {
+  if (heap == NULL)
+    heap = defaultHeap;
+  if (heap == NULL) {
+    fprintf(out, "heap report: heap never used\n");
+    return;
+  }
+
+  struct reportClass classes[REPORT_CLASSES];
+  memset(classes, 0, sizeof(classes));
+  size_t liveBytes = 0, freeBytes = 0, largestFree = 0;
+
+  heap_lock(heap);
+  for (char *b = block_first(heap); b < HEAP_END(heap);) {
+    size_t meta = block_meta(heap, b);
+    size_t size = GET_SIZE(meta);
+    struct reportClass *c = &classes[report_class(size)];
+    if (IS_FREE(meta)) {
+      c->freeBlocks++;
+      c->freeBytes += size;
+      freeBytes += size;
+      if (size > largestFree)
+        largestFree = size;
+    } else {
+      c->liveBlocks++;
+      c->liveBytes += size;
+      liveBytes += size;
+    }
+    b = block_next(heap, b, meta);
+  }
+  // Binned blocks are marked allocated but free to the owner, as in
+  // myHeapGetStats
+  size_t binnedBlocks = 0, binnedBytes = 0;
+  for (int i = 0; i < FAST_BINS; i++) {
+    struct reportClass *c = &classes[report_class((size_t)i * ALIGNMENT)];
+    for (size_t off = heap->fastBins[i]; off != 0; off = fast_next(heap, off)) {
+      c->liveBlocks--;
+      c->liveBytes -= (size_t)i * ALIGNMENT;
+      c->freeBlocks++;
+      c->freeBytes += (size_t)i * ALIGNMENT;
+      binnedBlocks++;
+      binnedBytes += (size_t)i * ALIGNMENT;
+    }
+  }
+  liveBytes -= binnedBytes;
+  freeBytes += binnedBytes;
+  size_t used = heap->endOff - heap->startOff;
+  size_t untouched = heap->maxOff - heap->endOff;
+  size_t topBytes = heap->topOff - heap->endOff, committed = heap->topOff;
+  size_t indexed = heap->freeCount, indexCap = heap->freeCap;
+  size_t largeObjects = 0, largeBytes = 0, largeCommitted = 0,
+         largeReserved = 0;
+  for (struct largeObject *lo = heap->large; lo != NULL; lo = lo->next) {
+    largeObjects++;
+    largeBytes += lo->size;
+    largeCommitted += lo->committed;
+    largeReserved += lo->reserved;
+  }
+  heap_unlock(heap);
+
+  fprintf(out, "heap report for %p\n", (void *)heap);
+  fprintf(out, "  mapped %zu, used %zu, live %zu, free %zu, untouched %zu\n",
+          heap->mapSize, used, liveBytes, freeBytes, untouched);
+  fprintf(out, "  top chunk %zu, committed %zu of %zu\n", topBytes,
+          committed, heap->maxOff);
+  // Free space that no single request can use is fragmentation; live bytes
+  // that keep growing are a leak
+  fprintf(out, "  largest free block %zu (%.1f%% of free bytes)\n",
+          largestFree, freeBytes ? 100.0 * largestFree / freeBytes : 100.0);
+  if (heap->flags & MYHEAP_FREE_INDEX)
+    fprintf(out, "  free index %zu of %zu entries\n", indexed, indexCap);
+  if (heap->flags & MYHEAP_FAST_BINS)
+    fprintf(out, "  fast bins %zu blocks, %zu bytes (counted as free below)\n",
+            binnedBlocks, binnedBytes);
+  if (largeObjects > 0)
+    fprintf(out,
+            "  large objects %zu, %zu bytes, committed %zu of %zu "
+            "(not in the classes below)\n",
+            largeObjects, largeBytes, largeCommitted, largeReserved);
+  fprintf(out, "  %10s %12s %12s %12s %12s\n", "size <=", "live blocks",
+          "live bytes", "free blocks", "free bytes");
+  for (int i = 0; i < REPORT_CLASSES; i++) {
+    struct reportClass *c = &classes[i];
+    if (c->liveBlocks == 0 && c->freeBlocks == 0)
+      continue;
+    if (i == REPORT_CLASSES - 1)
+      fprintf(out, "  %10s", "larger");
+    else
+      fprintf(out, "  %10zu", (size_t)16 << i);
+    fprintf(out, " %12zu %12zu %12zu %12zu\n", c->liveBlocks, c->liveBytes,
+            c->freeBlocks, c->freeBytes);
+  }
+
+#ifdef HEAP_PROFILER
+  // Sites are sampled over every heap, not just this one
+  struct reportSite top[REPORT_SITES + 1];
+  memset(top, 0, sizeof(top));
+  heapProfilerForEachSite(report_site, top);
+  fprintf(out, "  top live allocation sites (sampled, all heaps):\n");
+  for (int i = 0; i < REPORT_SITES && top[i].bytes > 0; i++) {
+    fprintf(out, "  %12zu bytes %8zu objects @", top[i].bytes, top[i].objects);
+    for (int d = 0; d < top[i].depth; d++)
+      fprintf(out, " %p", top[i].stack[d]);
+    fputc('\n', out);
+  }
+#endif
+}
+
+static myHeap *reportHeap; // NULL: the default heap, looked up at exit
+static int reportRegistered;
+
+static void report_at_exit(void) { myHeapReport(reportHeap, stderr); }
+
+void myHeapReportAtExit(myHeap *heap) {
+  reportHeap = heap;
+  if (!reportRegistered)
+    atexit(report_at_exit);
+  reportRegistered = 1;
+}
+
+// Gives the whole pages in [start, end) back to the OS, returns their bytes
+static size_t release_pages(char *start, char *end) {
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t from = ((uintptr_t)start + page - 1) & ~(page - 1);
+  uintptr_t to = (uintptr_t)end & ~(page - 1);
+  if (from >= to)
+    return 0;
+  madvise((void *)from, to - from, MADV_DONTNEED);
+  return to - from;
+}
+
+// Releases the pages inside free blocks, which keep nothing in their
+// payload (binned ones do: their link). With aged set, only blocks already
+// free at the last aging pass are released and the others become aged.
+static size_t purge_free(myHeap *heap, int aged) {
+  size_t released = 0;
+  if (heap->flags & MYHEAP_MLOCK)
+    return 0; // pinned on purpose
+  for (char *b = block_first(heap); b < HEAP_END(heap);) {
+    size_t meta = block_meta(heap, b);
+    if (IS_FREE(meta) && (!aged || IS_AGED(meta)))
+      released += release_pages(b, b + GET_SIZE(meta));
+    else if (IS_FREE(meta))
+      block_set_meta(heap, b, MARK_AGED(meta));
+    b = block_next(heap, b, meta);
+  }
+  return released;
+}
+
+// Decommits the top chunk past pad bytes; top_extend commits it again,
+// fresh. Returns the bytes decommitted.
+static size_t trim_top(myHeap *heap, size_t pad) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t keep = pad < heap->maxOff - heap->endOff ? heap->endOff + pad
+                                                   : heap->maxOff;
+  keep = (keep + page - 1) / page * page;
+  if (keep >= heap->topOff)
+    return 0;
+  prefault_drop(heap);
+  size_t released = heap->topOff - keep;
+  if (heap->flags & MYHEAP_MLOCK)
+    munlock((char *)heap + keep, released);
+  madvise((char *)heap + keep, released, MADV_DONTNEED);
+  mprotect((char *)heap + keep, released, PROT_NONE);
+  heap->topOff = keep;
+  if (heap->dirtyOff > keep)
+    heap->dirtyOff = keep;
+  return released;
+}
+
+int myHeapTrim(myHeap *heap, size_t pad) {
+  if (heap == NULL || !(heap->flags & HEAP_GROWABLE))
+    return 0;
+  heap_lock(heap);
+  size_t released = purge_free(heap, 0);
+  released += trim_top(heap, pad);
+  heap_unlock(heap);
+  HEAP_PROBE2(purge, heap, released);
+  return released != 0;
+}
+
+/**
+ * Background maintenance: with maintenance_ms > 0 a thread wakes up every
+ * maintenance_ms and, for each heap in maintHeaps, consolidates the fast
+ * bins and, every purge_ms, runs an aging pass. A free block that was
+ * already free at the previous pass has been for at least purge_ms, so
+ * its pages are released; the other free blocks are marked aged. A free
+ * (or merged, or split) block starts out young again. The top chunk is
+ * trimmed to one grow step in the same pass.
+ *
+ * maintLock guards the list and is held for a whole round, so a heap
+ * leaves the list (myHeapDestroy) only between rounds. Only heaps that
+ * lock on every call from their creation on (MYHEAP_MAINTAINED, or shared)
+ * can join it.
+ */
+static myHeap *maintHeaps[MAINT_HEAPS];
+static pthread_mutex_t maintLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maintWake = PTHREAD_COND_INITIALIZER;
+static pthread_t maintThread;
+static int maintRunning, maintStopping, maintHooked;
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void heap_maintain(myHeap *heap, uint64_t now) {
+  heap_lock(heap);
+  if (!fast_bins_empty(heap))
+    consolidate(heap);
+  if (now - heap->agedAt >= tunable(MYMALLOPT_PURGE_MS)) {
+    heap->agedAt = now;
+    size_t released = 0;
+    if (heap->flags & HEAP_GROWABLE)
+      released = purge_free(heap, 1) + trim_top(heap, heap->growStep);
+    HEAP_PROBE2(purge, heap, released);
+    (void)released; // probe argument only
+  }
+  heap_unlock(heap);
+}
+
+static void *maint_main(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&maintLock);
+  size_t period;
+  while (!maintStopping && (period = tunable(MYMALLOPT_MAINTENANCE_MS)) > 0) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += period / 1000;
+    until.tv_nsec += (long)(period % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000;
+    }
+    if (pthread_cond_timedwait(&maintWake, &maintLock, &until) != ETIMEDOUT)
+      continue; // woken to stop or for a new period, or spuriously
+    uint64_t now = now_ms();
+    for (int i = 0; i < MAINT_HEAPS; i++) {
+      if (maintHeaps[i] != NULL)
+        heap_maintain(maintHeaps[i], now);
+    }
+  }
+  // Switched off rather than stopped: nobody joins this thread, and a new
+  // period starts another one
+  if (!maintStopping) {
+    maintRunning = 0;
+    pthread_detach(pthread_self());
+  }
+  pthread_mutex_unlock(&maintLock);
+  return NULL;
+}
+
+// fork: no round and no call on a maintained heap may be half done when
+// the child gets its copy of the heaps. The thread itself is not copied.
+static void maint_prepare(void) {
+  pthread_mutex_lock(&maintLock);
+  for (int i = 0; i < MAINT_HEAPS; i++) {
+    if (maintHeaps[i] != NULL)
+      heap_lock(maintHeaps[i]);
+  }
+}
+
+static void maint_parent(void) {
+  for (int i = 0; i < MAINT_HEAPS; i++) {
+    if (maintHeaps[i] != NULL)
+      heap_unlock(maintHeaps[i]);
+  }
+  pthread_mutex_unlock(&maintLock);
+}
+
+static void maint_child(void) {
+  maintRunning = 0;
+  maint_parent();
+}
+
+void myHeapMaintainStop(void) {
+  pthread_mutex_lock(&maintLock);
+  int running = maintRunning;
+  maintStopping = 1;
+  maintRunning = 0;
+  pthread_cond_signal(&maintWake);
+  pthread_mutex_unlock(&maintLock);
+  if (running)
+    pthread_join(maintThread, NULL);
+  pthread_mutex_lock(&maintLock);
+  maintStopping = 0;
+  pthread_mutex_unlock(&maintLock);
+}
+
+// Puts heap on the list, returns -1 when it is full or the heap does not
+// lock. maintLock must be held.
+static int maint_add(myHeap *heap) {
+  // Switching a live heap to locking would race the threads inside it
+  if (!(heap->flags & (MYHEAP_SHARED | MYHEAP_MAINTAINED)))
+    return -1;
+  for (int i = 0; i < MAINT_HEAPS; i++) {
+    if (maintHeaps[i] == heap)
+      return 0;
+  }
+  for (int i = 0; i < MAINT_HEAPS; i++) {
+    if (maintHeaps[i] == NULL) {
+      heap_lock(heap);
+      heap->agedAt = now_ms();
+      heap_unlock(heap);
+      maintHeaps[i] = heap;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Starts the thread if maintenance_ms asks for it and it does not run.
+// maintLock must be held.
+static void maint_start(void) {
+  if (maintRunning || maintStopping || tunable(MYMALLOPT_MAINTENANCE_MS) == 0)
+    return;
+  // The default heap is looked after whenever the thread runs, if it was
+  // created maintained
+  if (defaultHeap != NULL && (defaultHeap->flags & MYHEAP_MAINTAINED))
+    maint_add(defaultHeap);
+  int heaps = 0;
+  for (int i = 0; i < MAINT_HEAPS; i++)
+    heaps += maintHeaps[i] != NULL;
+  if (heaps == 0)
+    return;
+  if (!maintHooked) {
+    pthread_atfork(maint_prepare, maint_parent, maint_child);
+    atexit(myHeapMaintainStop);
+    maintHooked = 1;
+  }
+  maintRunning = pthread_create(&maintThread, NULL, maint_main, NULL) == 0;
+}
+
+int myHeapMaintain(myHeap *heap) {
+  pthread_mutex_lock(&maintLock);
+  int rc = maint_add(heap);
+  if (rc == 0)
+    maint_start();
+  pthread_mutex_unlock(&maintLock);
+  return rc;
+}
+
+// Kept with the maintenance code: a new maintenance_ms applies at once
+int myMallopt(int param, size_t value) {
+  pthread_once(&tunablesOnce, tunables_load);
+  int rc = config_set(tunables, param, value);
+  if (rc == 0 && param == MYMALLOPT_MAINTENANCE_MS) {
+    pthread_mutex_lock(&maintLock);
+    pthread_cond_signal(&maintWake); // rereads the period, or exits on 0
+    maint_start();
+    pthread_mutex_unlock(&maintLock);
+  }
+  return rc;
+}
+
+// Takes heap off the list, waiting for a round in progress
+static void maint_forget(myHeap *heap) {
+  pthread_mutex_lock(&maintLock);
+  for (int i = 0; i < MAINT_HEAPS; i++) {
+    if (maintHeaps[i] == heap)
+      maintHeaps[i] = NULL;
+  }
+  pthread_mutex_unlock(&maintLock);
+}
+
+void myHeapDestroy(myHeap *heap) {
+  // Blocks never leave the heap's region, so one munmap drops everything.
+  // Heaps in caller buffers have nothing to release. For a shared heap this
+  // only unmaps it from this process; the segment lives on with its fd.
+  if (heap == NULL)
     return;
+  maint_forget(heap);
+  prefault_drop(heap);
+  while (heap->large != NULL) {
+    struct largeObject *lo = heap->large;
+    heap->large = lo->next;
+    munmap(lo, lo->reserved);
   }
+  if (heap->flags & MYHEAP_FREE_INDEX)
+    index_disable(heap);
+  // A shared heap's lock belongs to every process that maps it
+  if ((heap->flags & MYHEAP_MAINTAINED) && !(heap->flags & MYHEAP_SHARED))
+    pthread_mutex_destroy(&heap->lock);
+  if (heap->flags & HEAP_MAPPED)
+    munmap(heap, heap->mapSize);
+}
 
-  // Go backwards in memory from the payload pointer to the
-  // header of that block and set it to free
-  struct header *h = (struct header *)p - 1;
-  MARK_FREE(h);
+void *myAlloc(size_t size) {
+  // If the heap is not initialised
+  if (defaultHeap == NULL) {
+    // Maintenance must be asked for before the first allocation: a heap
+    // in use cannot start locking
+    int maintained = tunable(MYMALLOPT_MAINTENANCE_MS) > 0;
+    defaultHeap =
+        myHeapCreate(NULL, tunable(MYMALLOPT_HEAP_SIZE),
+                     maintained ? MYHEAP_MAINTAINED : MYHEAP_NONE);
+    if (defaultHeap == NULL)
+      return NULL;
+    if (maintained)
+      myHeapMaintain(defaultHeap);
+  }
+  return myHeapAlloc(defaultHeap, size);
+}
+
+void myFree(void *p) {
+  if (defaultHeap == NULL) {
+    if (p != NULL)
+      free_error(ERR_INVALID_FREE, "invalid free pointer");
+    return;
+  }
+  myHeapFree(defaultHeap, p);
+}
+
+static void heap_mallinfo(myHeap *heap, struct myMallinfo2 *mi) {
+  memset(mi, 0, sizeof(*mi));
+  if (heap == NULL)
+    return;
+  heap_lock(heap);
+  mi->arena = heap->endOff - heap->startOff;
+  for (char *b = block_first(heap); b < HEAP_END(heap);) {
+    size_t meta = block_meta(heap, b);
+    if (IS_FREE(meta)) {
+      mi->ordblks++;
+      mi->fordblks += GET_SIZE(meta);
+    } else {
+      mi->uordblks += GET_SIZE(meta);
+    }
+    b = block_next(heap, b, meta);
+  }
+  // Binned blocks are marked allocated but free to the owner
+  fast_bin_totals(heap, &mi->smblks, &mi->fsmblks);
+  mi->uordblks -= mi->fsmblks;
+  mi->fordblks += mi->fsmblks;
+  mi->keepcost = heap->topOff - heap->endOff;
+  mi->hblks = heap->largeCount;
+  mi->hblkhd = heap->largeBytes;
+  heap_unlock(heap);
+}
+
+struct myMallinfo2 myMallinfo2(void) {
+  struct myMallinfo2 mi;
+  heap_mallinfo(defaultHeap, &mi);
+  return mi;
+}
+
+void myMallocStats(void) {
+  struct myMallinfo2 mi;
+  heap_mallinfo(defaultHeap, &mi);
+  size_t maxRegions = 0, maxBytes = 0;
+  if (defaultHeap != NULL) {
+    heap_lock(defaultHeap);
+    maxRegions = defaultHeap->largeMaxCount;
+    maxBytes = defaultHeap->largeMaxBytes;
+    heap_unlock(defaultHeap);
+  }
+  size_t system = mi.arena + mi.keepcost;
+  fprintf(stderr, "Arena 0:\n");
+  fprintf(stderr, "system bytes     = %10zu\n", system);
+  fprintf(stderr, "in use bytes     = %10zu\n", mi.uordblks);
+  fprintf(stderr, "Total (incl. mmap):\n");
+  fprintf(stderr, "system bytes     = %10zu\n", system + mi.hblkhd);
+  fprintf(stderr, "in use bytes     = %10zu\n", mi.uordblks + mi.hblkhd);
+  fprintf(stderr, "max mmap regions = %10zu\n", maxRegions);
+  fprintf(stderr, "max mmap bytes   = %10zu\n", maxBytes);
+}
+
+int myMallocTrim(size_t pad) { return myHeapTrim(defaultHeap, pad); }
+
+int myMallocInfo(int options, FILE *out) {
+  if (options != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  myHeap *heap = defaultHeap;
+  struct reportClass classes[REPORT_CLASSES];
+  memset(classes, 0, sizeof(classes));
+  struct myMallinfo2 mi;
+  heap_mallinfo(heap, &mi);
+  size_t system = mi.arena + mi.keepcost, maxSystem = system;
+  if (heap != NULL) {
+    heap_lock(heap);
+    for (char *b = block_first(heap); b < HEAP_END(heap);) {
+      size_t meta = block_meta(heap, b);
+      if (IS_FREE(meta)) {
+        classes[report_class(GET_SIZE(meta))].freeBlocks++;
+        classes[report_class(GET_SIZE(meta))].freeBytes += GET_SIZE(meta);
+      }
+      b = block_next(heap, b, meta);
+    }
+    if (heap->dirtyOff - heap->startOff > maxSystem)
+      maxSystem = heap->dirtyOff - heap->startOff;
+    heap_unlock(heap);
+  }
+
+  fprintf(out, "<malloc version=\"1\">\n<heap nr=\"0\">\n<sizes>\n");
+  for (int c = 0; c < REPORT_CLASSES; c++) {
+    if (classes[c].freeBlocks == 0)
+      continue;
+    size_t from = c == 0 ? 1 : ((size_t)16 << (c - 1)) + 1;
+    size_t to = c == REPORT_CLASSES - 1 ? mi.arena : (size_t)16 << c;
+    fprintf(out,
+            "  <size from=\"%zu\" to=\"%zu\" total=\"%zu\" count=\"%zu\"/>\n",
+            from, to, classes[c].freeBytes, classes[c].freeBlocks);
+  }
+  fprintf(out, "</sizes>\n");
+  for (int total = 0; total < 2; total++) {
+    fprintf(out, "<total type=\"fast\" count=\"%zu\" size=\"%zu\"/>\n",
+            mi.smblks, mi.fsmblks);
+    fprintf(out, "<total type=\"rest\" count=\"%zu\" size=\"%zu\"/>\n",
+            mi.ordblks, mi.fordblks - mi.fsmblks);
+    if (total)
+      fprintf(out, "<total type=\"mmap\" count=\"%zu\" size=\"%zu\"/>\n",
+              mi.hblks, mi.hblkhd);
+    fprintf(out, "<system type=\"current\" size=\"%zu\"/>\n", system);
+    fprintf(out, "<system type=\"max\" size=\"%zu\"/>\n", maxSystem);
+    fprintf(out, "<aspace type=\"total\" size=\"%zu\"/>\n", system);
+    fprintf(out, "<aspace type=\"mprotect\" size=\"%zu\"/>\n", system);
+    if (!total)
+      fprintf(out, "</heap>\n");
+  }
+  fprintf(out, "</malloc>\n");
+  return 0;
 }
 
+#if defined(MYALLOC_GLIBC_NAMES) && defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+// Stand in for glibc's own, which only know about glibc's malloc
+struct mallinfo2 mallinfo2(void) {
+  struct myMallinfo2 mi = myMallinfo2();
+  struct mallinfo2 out = {
+      .arena = mi.arena,       .ordblks = mi.ordblks,
+      .smblks = mi.smblks,     .hblks = mi.hblks,
+      .hblkhd = mi.hblkhd,     .usmblks = mi.usmblks,
+      .fsmblks = mi.fsmblks,   .uordblks = mi.uordblks,
+      .fordblks = mi.fordblks, .keepcost = mi.keepcost,
+  };
+  return out;
+}
+
+void malloc_stats(void) { myMallocStats(); }
+
+int malloc_trim(size_t pad) { return myMallocTrim(pad); }
+
+int malloc_info(int options, FILE *out) { return myMallocInfo(options, out); }
+#endif
+#endif
+
+#ifndef MYALLOC_NO_MAIN
 int main() {
   int *p = (int *)myAlloc(4);
   char *q = (char *)myAlloc(1000);
@@ -204,5 +2134,220 @@ int main() {
   assert(p == r);
   printf("p: %p, q: %p, r: %p\n", p, q, r);
 
+  // The last block goes back to the top chunk, which trimming releases
+  myFree(q);
+  struct myMallinfo2 mi = myMallinfo2();
+  assert(mi.uordblks == 8 && mi.ordblks == 0 && mi.keepcost > 0);
+  int trimmed = myMallocTrim(0);
+  assert(trimmed == 1);
+  assert(myMallinfo2().keepcost < mi.keepcost);
+  trimmed = myMallocTrim(0);
+  assert(trimmed == 0); // nothing left to release
+
+  // A separate heap with its own region, released in one go
+  myHeap *heap = myHeapCreate(NULL, 4096, MYHEAP_ZERO);
+  long *l = (long *)myHeapAlloc(heap, sizeof(long));
+  assert(*l == 0);
+  // Sizes near SIZE_MAX must fail, not wrap around to a small block
+  assert(myHeapAlloc(heap, SIZE_MAX - 7) == NULL);
+  assert(myHeapAlloc(heap, SIZE_MAX - ALIGNMENT - 64) == NULL);
+  assert(myHeapRealloc(heap, l, SIZE_MAX - 7) == NULL && *l == 0);
+  myHeapFree(heap, l);
+  myHeapDestroy(heap);
+
+  // Sizes and flags out of band: payloads are packed back to back
+  heap = myHeapCreate(NULL, 4096, MYHEAP_OOB_META);
+  char *a = (char *)myHeapAlloc(heap, 16);
+  char *b = (char *)myHeapAlloc(heap, 16);
+  assert(b == a + 16);
+  myHeapFree(heap, a + 8); // not a block: reported, heap unharmed
+  assert(myHeapCheck(heap) == 0);
+  myHeapDestroy(heap);
+
+  // A growable buffer: it grows and shrinks in place within its
+  // reservation, only a resize past it moves the payload
+  heap = myHeapCreate(NULL, 1 << 20, MYHEAP_NONE);
+  char *buf = (char *)myHeapAllocGrowable(heap, 100, 64 << 20);
+  assert(buf != NULL);
+  memset(buf, 'x', 100);
+  char *resized = (char *)myHeapRealloc(heap, buf, 16 << 20);
+  assert(resized == buf && buf[99] == 'x');
+  buf[(16 << 20) - 1] = 'y';
+  resized = (char *)myHeapRealloc(heap, buf, 4096);
+  assert(resized == buf && buf[99] == 'x');
+  struct myHeapStats stats;
+  myHeapGetStats(heap, &stats);
+  assert(stats.liveBlocks == 1 && stats.mappedBytes < (2 << 20));
+  char *moved = (char *)myHeapRealloc(heap, buf, 128 << 20);
+  assert(moved != NULL && moved != buf && moved[99] == 'x');
+  assert(myHeapCheck(heap) == 0);
+  myHeapFree(heap, moved);
+  myHeapGetStats(heap, &stats);
+  assert(stats.liveBlocks == 0);
+  myHeapDestroy(heap);
+
+  // The report agrees with the stats on binned blocks: free, not live
+  heap = myHeapCreate(NULL, 4096, MYHEAP_FAST_BINS);
+  void *small[3];
+  for (int i = 0; i < 3; i++)
+    small[i] = myHeapAlloc(heap, 32);
+  void *kept = myHeapAlloc(heap, 100);
+  for (int i = 0; i < 3; i++)
+    myHeapFree(heap, small[i]);
+  char *text;
+  size_t textLen, mapped, used, live, freed;
+  FILE *out = open_memstream(&text, &textLen);
+  myHeapReport(heap, out);
+  fclose(out);
+  int fields = sscanf(strchr(text, '\n') + 1,
+                      "  mapped %zu, used %zu, live %zu, free %zu", &mapped,
+                      &used, &live, &freed);
+  assert(fields == 4);
+  myHeapGetStats(heap, &stats);
+  assert(live == stats.liveBytes && freed == stats.freeBytes);
+  free(text);
+  myHeapFree(heap, kept);
+  myHeapDestroy(heap);
+
+  // Past large_threshold the default heap maps objects on their own
+  void *large = myAlloc(1 << 20);
+  assert(large != NULL && myMallinfo2().hblks == 1);
+  myFree(large);
+  assert(myMallinfo2().hblks == 0);
+  // myMallocStats still shows the peak
+  FILE *statsOut = tmpfile();
+  int savedStderr = dup(STDERR_FILENO);
+  fflush(stderr);
+  dup2(fileno(statsOut), STDERR_FILENO);
+  myMallocStats();
+  fflush(stderr);
+  dup2(savedStderr, STDERR_FILENO);
+  close(savedStderr);
+  rewind(statsOut);
+  char line[80];
+  size_t maxRegions = 0, maxBytes = 0;
+  while (fgets(line, sizeof(line), statsOut) != NULL) {
+    sscanf(line, "max mmap regions = %zu", &maxRegions);
+    sscanf(line, "max mmap bytes = %zu", &maxBytes);
+  }
+  fclose(statsOut);
+  assert(maxRegions == 1 && maxBytes > (1 << 20));
+
+  // Background maintenance trims the top chunk of a heap left with free
+  // space. The thread starts, stops when switched off, starts again and
+  // is restarted in a forked child. Sleeps, not spins: the thread needs
+  // the CPU.
+  heap = myHeapCreate(NULL, 64 << 20, MYHEAP_NONE);
+  int rc = myHeapMaintain(heap);
+  assert(rc == -1); // does not lock, so cannot be maintained
+  myHeapDestroy(heap);
+  heap = myHeapCreate(NULL, 64 << 20, MYHEAP_FAST_BINS | MYHEAP_MAINTAINED);
+  void *chunks[64];
+  for (int i = 0; i < 64; i++)
+    chunks[i] = myHeapAlloc(heap, 64 << 10);
+  for (int i = 63; i >= 0; i--)
+    myHeapFree(heap, chunks[i]);
+  myHeapGetStats(heap, &stats);
+  size_t grown = stats.mappedBytes;
+  assert(grown >= (4 << 20));
+  for (int i = 0; i < 64; i++)
+    chunks[i] = myAlloc(64 << 10);
+  for (int i = 63; i >= 0; i--)
+    myFree(chunks[i]);
+  assert(myMallinfo2().keepcost >= (4 << 20));
+  rc = myMallopt(MYMALLOPT_PURGE_MS, 1);
+  rc |= myMallopt(MYMALLOPT_MAINTENANCE_MS, 5);
+  rc |= myHeapMaintain(heap);
+  assert(rc == 0);
+  usleep(100000);
+  myHeapGetStats(heap, &stats);
+  assert(stats.mappedBytes < grown);
+  // The default heap was in use before maintenance was asked for: left
+  // alone
+  assert(myMallinfo2().keepcost >= (4 << 20));
+
+  rc = myMallopt(MYMALLOPT_MAINTENANCE_MS, 0);
+  assert(rc == 0);
+  usleep(50000);
+  for (int i = 0; i < 64; i++)
+    chunks[i] = myHeapAlloc(heap, 64 << 10);
+  for (int i = 63; i >= 0; i--)
+    myHeapFree(heap, chunks[i]);
+  usleep(50000);
+  myHeapGetStats(heap, &stats);
+  assert(stats.mappedBytes >= grown); // off: nothing trimmed
+
+  rc = myMallopt(MYMALLOPT_MAINTENANCE_MS, 5);
+  assert(rc == 0);
+  usleep(100000);
+  myHeapGetStats(heap, &stats);
+  assert(stats.mappedBytes < grown);
+
+  pid_t child = fork();
+  if (child == 0) {
+    // The thread is not copied; myHeapMaintain brings it back
+    myHeapMaintain(heap);
+    for (int i = 0; i < 64; i++)
+      chunks[i] = myHeapAlloc(heap, 64 << 10);
+    for (int i = 63; i >= 0; i--)
+      myHeapFree(heap, chunks[i]);
+    usleep(100000);
+    myHeapGetStats(heap, &stats);
+    _exit(stats.mappedBytes < grown && myHeapCheck(heap) == 0 ? 0 : 1);
+  }
+  int status;
+  pid_t waited = waitpid(child, &status, 0);
+  assert(waited == child && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  myHeapMaintainStop();
+  rc = myMallopt(MYMALLOPT_MAINTENANCE_MS, 0);
+  rc |= myMallopt(MYMALLOPT_PURGE_MS, PURGE_MS);
+  assert(rc == 0);
+  assert(myHeapCheck(heap) == 0);
+  myHeapDestroy(heap);
+
+#ifdef __linux__
+  // A heap in shared memory: the child maps the segment on its own (at a
+  // different address), allocates a message and passes only its offset.
+  int fd = memfd_create("myheap", 0);
+  myHeap *shared = myHeapCreateShared(fd, 1 << 16, MYHEAP_NONE);
+  int pipefd[2];
+  int piped = pipe(pipefd);
+  assert(shared != NULL && piped == 0);
+  if (fork() == 0) {
+    myHeap *child = myHeapAttach(fd);
+    char *msg = (char *)myHeapAlloc(child, 32);
+    strcpy(msg, "hello from the child");
+    size_t off = myHeapOffset(child, msg);
+    write(pipefd[1], &off, sizeof(off));
+    _exit(0);
+  }
+  size_t off;
+  ssize_t got = read(pipefd[0], &off, sizeof(off));
+  assert(got == sizeof(off));
+  wait(NULL);
+  char *msg = (char *)myHeapPointer(shared, off);
+  printf("shared message: %s\n", msg);
+  myHeapFree(shared, msg);
+  myHeapDestroy(shared);
+  close(fd);
+#endif
+
+  // A heap persisted in a file: reopening it finds the data again
+  char path[] = "/tmp/myheap-XXXXXX";
+  close(mkstemp(path));
+  myHeap *persisted = myHeapOpenFile(path, 1 << 16, MYHEAP_NONE);
+  char *greeting = (char *)myHeapAlloc(persisted, 32);
+  strcpy(greeting, "hello from the last run");
+  myHeapSetRoot(persisted, greeting);
+  myHeapSync(persisted);
+  myHeapDestroy(persisted);
+
+  persisted = myHeapOpenFile(path, 1 << 16, MYHEAP_NONE);
+  assert(persisted != NULL);
+  printf("persisted root: %s\n", (char *)myHeapGetRoot(persisted));
+  myHeapDestroy(persisted);
+  unlink(path);
+
   return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,89 @@
+#include <string.h>
+
+#include "latency_hist.h"
+
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+// Values below SUB_BUCKETS get one bucket each, every larger power of two
+// gets SUB_BUCKETS of them
+#define BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+#define MAX_THREADS 256
+
+struct histogram {
+  uint64_t counts[LAT_KINDS][BUCKETS];
+  uint64_t max[LAT_KINDS];
+};
+
+// Slots are never handed back, so a thread's samples outlive it. Threads
+// beyond MAX_THREADS share the last slot and update it atomically.
+static struct histogram histograms[MAX_THREADS];
+static unsigned threadCount;
+static __thread struct histogram *mine;
+
+static int bucket_of(uint64_t v) {
+  if (v < SUB_BUCKETS)
+    return (int)v;
+  int e = 63 - __builtin_clzll(v); // >= SUB_BITS
+  int sub = (v >> (e - SUB_BITS)) & (SUB_BUCKETS - 1);
+  return (e - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+// Highest value that falls into bucket b
+static uint64_t bucket_top(int b) {
+  if (b < SUB_BUCKETS)
+    return b;
+  int e = b / SUB_BUCKETS + SUB_BITS - 1;
+  uint64_t low = (uint64_t)(SUB_BUCKETS + b % SUB_BUCKETS) << (e - SUB_BITS);
+  return low + ((uint64_t)1 << (e - SUB_BITS)) - 1;
+}
+
+void latencyRecord(enum latencyKind kind, uint64_t ticks) {
+  if (mine == NULL) {
+    unsigned slot = __atomic_fetch_add(&threadCount, 1, __ATOMIC_RELAXED);
+    mine = &histograms[slot < MAX_THREADS ? slot : MAX_THREADS - 1];
+  }
+  int b = bucket_of(ticks);
+  if (mine != &histograms[MAX_THREADS - 1]) {
+    mine->counts[kind][b]++;
+    if (ticks > mine->max[kind])
+      mine->max[kind] = ticks;
+    return;
+  }
+  __atomic_fetch_add(&mine->counts[kind][b], 1, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&mine->max[kind], __ATOMIC_RELAXED);
+  while (ticks > max &&
+         !__atomic_compare_exchange_n(&mine->max[kind], &max, ticks, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+void latencyPercentiles(enum latencyKind kind, struct myHeapLatency *out) {
+  static const double pcts[] = {0.50, 0.90, 0.99, 0.999};
+  uint64_t *results[] = {&out->p50, &out->p90, &out->p99, &out->p999};
+  uint64_t merged[BUCKETS];
+  memset(merged, 0, sizeof(merged));
+  memset(out, 0, sizeof(*out));
+
+  // Other threads keep recording meanwhile; a slightly stale view is fine
+  unsigned threads = __atomic_load_n(&threadCount, __ATOMIC_RELAXED);
+  if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+  for (unsigned t = 0; t < threads; t++) {
+    for (int b = 0; b < BUCKETS; b++) {
+      uint64_t n =
+          __atomic_load_n(&histograms[t].counts[kind][b], __ATOMIC_RELAXED);
+      merged[b] += n;
+      out->count += n;
+    }
+    if (histograms[t].max[kind] > out->max)
+      out->max = histograms[t].max[kind];
+  }
+
+  uint64_t seen = 0;
+  int next = 0;
+  for (int b = 0; b < BUCKETS && next < 4; b++) {
+    seen += merged[b];
+    while (next < 4 && merged[b] > 0 && seen >= pcts[next] * out->count)
+      *results[next++] = bucket_top(b);
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "heap.h"
+
+/**
+ * Per-thread latency histograms for the allocator.
+ *
+ * Build the allocator with -DHEAP_LATENCY and link latency_hist.c. Every
+ * myHeapAlloc/myHeapFree is timed with the cycle counter and counted in a
+ * log-linear (HDR style) histogram owned by the calling thread: 16 linear
+ * sub-buckets per power of two, so any value is kept within 1/16 (~6%) of
+ * its real size while 976 buckets cover the whole 64-bit range. Threads
+ * never share a histogram, so recording is a plain increment.
+ */
+
+enum latencyKind {
+  LAT_ALLOC_FAST, // served from an existing block
+  LAT_ALLOC_SLOW, // heap growth or out of memory
+  LAT_FREE_FAST,
+  LAT_FREE_SLOW,
+  LAT_KINDS
+};
+
+// Cycle counter on x86 and arm64, nanoseconds elsewhere
+static inline uint64_t latencyNow(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t t;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+  return t;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+void latencyRecord(enum latencyKind kind, uint64_t ticks);
+// Merges the histograms of every thread seen so far
+void latencyPercentiles(enum latencyKind kind, struct myHeapLatency *out);
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef POLICY_HEAP_HPP
+#define POLICY_HEAP_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+
+/**
+ * Header-only allocator assembled from policies (C++17).
+ *
+ * The C strategies hardwire their pieces with #defines; here every piece is
+ * a template parameter, so each service can pick its own combination and
+ * the compiler generates (and inlines) a fast path for exactly that one:
+ *
+ *   myheap::Heap<myheap::SegregatedFit, myheap::CompactHeader,
+ *                myheap::NoLock, myheap::MmapBacking> heap(1 << 20);
+ *   void *p = heap.allocate(100);
+ *   heap.deallocate(p);
+ *
+ * Placement  where a request goes and how free blocks are found:
+ *            FirstFit (walk the header chain, as implicit_free _list.c) or
+ *            SegregatedFit (free lists per power-of-two size class)
+ * Header     how size and free flag are encoded in front of each block:
+ *            WordHeader (one size_t, as implicit_free _list.c) or
+ *            CompactHeader (32 bits, for payloads below 4 GiB)
+ * Lock       NoLock, SpinLock or MutexLock
+ * Backing    where the region comes from: MmapBacking or BufferBacking
+ *
+ * Blocks are laid out as in the implicit free list (header, then payload)
+ * and are split on allocation and merged with a free successor on free.
+ */
+
+namespace myheap {
+
+constexpr std::size_t kAlignment = alignof(std::max_align_t) < 8
+                                       ? alignof(std::max_align_t)
+                                       : 8;
+
+constexpr std::size_t alignUp(std::size_t s, std::size_t a) {
+  return (s + a - 1) & ~(a - 1);
+}
+
+/**
+ * Header policies: bit 0 is the free flag, the rest the payload size.
+ */
+
+struct WordHeader {
+  static constexpr std::size_t kSize = sizeof(std::size_t);
+  static constexpr std::size_t kMaxPayload = ~std::size_t(0) & ~std::size_t(1);
+
+  static std::size_t size(const char *h) {
+    return load(h) & ~std::size_t(1);
+  }
+  static bool isFree(const char *h) { return load(h) & 1; }
+  static void set(char *h, std::size_t size, bool free) {
+    std::size_t v = size | (free ? 1 : 0);
+    std::memcpy(h, &v, sizeof(v));
+  }
+
+private:
+  static std::size_t load(const char *h) {
+    std::size_t v;
+    std::memcpy(&v, h, sizeof(v));
+    return v;
+  }
+};
+
+struct CompactHeader {
+  static constexpr std::size_t kSize = sizeof(std::uint32_t);
+  static constexpr std::size_t kMaxPayload = 0xfffffff8u;
+
+  static std::size_t size(const char *h) { return load(h) & ~1u; }
+  static bool isFree(const char *h) { return load(h) & 1u; }
+  static void set(char *h, std::size_t size, bool free) {
+    std::uint32_t v = static_cast<std::uint32_t>(size) | (free ? 1u : 0u);
+    std::memcpy(h, &v, sizeof(v));
+  }
+
+private:
+  static std::uint32_t load(const char *h) {
+    std::uint32_t v;
+    std::memcpy(&v, h, sizeof(v));
+    return v;
+  }
+};
+
+/**
+ * Lock policies.
+ */
+
+struct NoLock {
+  void lock() {}
+  void unlock() {}
+};
+
+class SpinLock {
+public:
+  void lock() {
+    while (flag_.test_and_set(std::memory_order_acquire)) {
+    }
+  }
+  void unlock() { flag_.clear(std::memory_order_release); }
+
+private:
+  std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
+};
+
+class MutexLock {
+public:
+  void lock() { mutex_.lock(); }
+  void unlock() { mutex_.unlock(); }
+
+private:
+  std::mutex mutex_;
+};
+
+/**
+ * Backing policies: hand out the heap's region once and take it back.
+ */
+
+struct MmapBacking {
+  void *acquire(std::size_t size) {
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+  }
+  void release(void *p, std::size_t size) { munmap(p, size); }
+};
+
+class BufferBacking {
+public:
+  explicit BufferBacking(void *buffer) : buffer_(buffer) {}
+  void *acquire(std::size_t) { return buffer_; }
+  void release(void *, std::size_t) {}
+
+private:
+  void *buffer_;
+};
+
+/**
+ * Placement policies. Each provides Index<Header>, the structure that finds
+ * free blocks: find() returns a free block with at least `need` payload
+ * bytes or nullptr; insert()/remove() are told about every block that
+ * becomes free or stops being free.
+ */
+
+struct FirstFit {
+  // The header chain is the index: nothing to maintain, find() walks it
+  template <class Header> class Index {
+  public:
+    static constexpr std::size_t kMinPayload = kAlignment;
+
+    void init(char *start) { start_ = start; }
+    char *find(std::size_t need, char *end) const {
+      for (char *b = start_; b < end; b += Header::kSize + Header::size(b)) {
+        if (Header::isFree(b) && Header::size(b) >= need)
+          return b;
+      }
+      return nullptr;
+    }
+    void insert(char *) {}
+    void remove(char *) {}
+
+  private:
+    char *start_ = nullptr;
+  };
+};
+
+struct SegregatedFit {
+  // Doubly linked free lists per size class, links kept in the payload
+  template <class Header> class Index {
+  public:
+    static constexpr std::size_t kMinPayload = 2 * sizeof(char *);
+    static constexpr int kClasses = 48;
+
+    void init(char *) {
+      for (auto &head : heads_)
+        head = nullptr;
+    }
+
+    char *find(std::size_t need, char *) const {
+      // First fit inside the request's own class, then any block of a
+      // larger class fits
+      for (char *b = heads_[classOf(need)]; b != nullptr; b = next(b)) {
+        if (Header::size(b) >= need)
+          return b;
+      }
+      for (int c = classOf(need) + 1; c < kClasses; c++) {
+        if (heads_[c] != nullptr)
+          return heads_[c];
+      }
+      return nullptr;
+    }
+
+    void insert(char *b) {
+      char *&head = heads_[classOf(Header::size(b))];
+      setNext(b, head);
+      setPrev(b, nullptr);
+      if (head != nullptr)
+        setPrev(head, b);
+      head = b;
+    }
+
+    void remove(char *b) {
+      char *n = next(b), *p = prev(b);
+      if (p != nullptr)
+        setNext(p, n);
+      else
+        heads_[classOf(Header::size(b))] = n;
+      if (n != nullptr)
+        setPrev(n, p);
+    }
+
+  private:
+    // Class c holds payloads in [2^c, 2^(c+1))
+    static int classOf(std::size_t size) {
+      int c = 63 - __builtin_clzll(static_cast<unsigned long long>(size));
+      return c < kClasses ? c : kClasses - 1;
+    }
+    static char *link(const char *b, int i) {
+      char *v;
+      std::memcpy(&v, b + Header::kSize + i * sizeof(char *), sizeof(v));
+      return v;
+    }
+    static void setLink(char *b, int i, char *v) {
+      std::memcpy(b + Header::kSize + i * sizeof(char *), &v, sizeof(v));
+    }
+    static char *next(const char *b) { return link(b, 0); }
+    static char *prev(const char *b) { return link(b, 1); }
+    static void setNext(char *b, char *v) { setLink(b, 0, v); }
+    static void setPrev(char *b, char *v) { setLink(b, 1, v); }
+
+    char *heads_[kClasses];
+  };
+};
+
+/**
+ * The heap: a bump pointer (heapEnd) over one region plus the placement
+ * policy's index of the free blocks below it.
+ */
+template <class Placement, class Header, class Lock, class Backing>
+class Heap {
+  using Index = typename Placement::template Index<Header>;
+
+public:
+  explicit Heap(std::size_t size, Backing backing = Backing())
+      : backing_(backing), size_(size) {
+    region_ = static_cast<char *>(backing_.acquire(size));
+    if (region_ == nullptr)
+      throw std::bad_alloc();
+    // Headers sit right before aligned payloads, so the first block starts
+    // kSize bytes short of an alignment boundary
+    start_ = region_ + alignUp(Header::kSize, kAlignment) - Header::kSize;
+    end_ = start_;
+    max_ = region_ + size;
+    index_.init(start_);
+  }
+
+  ~Heap() { backing_.release(region_, size_); }
+
+  Heap(const Heap &) = delete;
+  Heap &operator=(const Heap &) = delete;
+
+  void *allocate(std::size_t n) {
+    // Rounding a larger n up (plus its header) would wrap around
+    if (n > Header::kMaxPayload - Header::kSize - kAlignment)
+      return nullptr;
+    std::size_t need = payloadFor(n);
+    if (need > Header::kMaxPayload)
+      return nullptr;
+
+    lock_.lock();
+    char *b = index_.find(need, end_);
+    if (b != nullptr) {
+      index_.remove(b);
+      split(b, need);
+      Header::set(b, Header::size(b), false);
+    } else if (static_cast<std::size_t>(max_ - end_) >= Header::kSize &&
+               need <= static_cast<std::size_t>(max_ - end_) - Header::kSize) {
+      b = end_;
+      Header::set(b, need, false);
+      end_ += Header::kSize + need;
+    }
+    lock_.unlock();
+    return b ? b + Header::kSize : nullptr;
+  }
+
+  void deallocate(void *p) {
+    if (p == nullptr)
+      return;
+    char *b = static_cast<char *>(p) - Header::kSize;
+
+    lock_.lock();
+    std::size_t size = Header::size(b);
+    // Merge with a free successor
+    char *next = b + Header::kSize + size;
+    if (next < end_ && Header::isFree(next)) {
+      index_.remove(next);
+      size += Header::kSize + Header::size(next);
+    }
+    if (b + Header::kSize + size == end_) {
+      // Last block: hand it back to the untouched tail
+      end_ = b;
+    } else {
+      Header::set(b, size, true);
+      index_.insert(b);
+    }
+    lock_.unlock();
+  }
+
+  // Bytes between the region start and heapEnd
+  std::size_t usedBytes() const { return end_ - region_; }
+
+  // Walks the header chain; true when it ends exactly on heapEnd
+  bool check() const {
+    char *b = start_;
+    while (b < end_) {
+      std::size_t size = Header::size(b);
+      if (size < Index::kMinPayload || (size + Header::kSize) % kAlignment)
+        return false;
+      b += Header::kSize + size;
+    }
+    return b == end_;
+  }
+
+private:
+  // Payload sizes keep every payload aligned: header plus payload is a
+  // multiple of kAlignment, so the next header ends on a boundary as well
+  static constexpr std::size_t payloadFor(std::size_t n) {
+    std::size_t s = n < Index::kMinPayload ? Index::kMinPayload : n;
+    return alignUp(s + Header::kSize, kAlignment) - Header::kSize;
+  }
+
+  // Returns the tail of b beyond `need` bytes to the index, when the tail
+  // can hold a block of its own
+  void split(char *b, std::size_t need) {
+    std::size_t size = Header::size(b);
+    if (size < need + Header::kSize + payloadFor(0))
+      return;
+    char *rest = b + Header::kSize + need;
+    Header::set(rest, size - need - Header::kSize, true);
+    Header::set(b, need, false);
+    index_.insert(rest);
+  }
+
+  Backing backing_;
+  Lock lock_;
+  Index index_;
+  std::size_t size_;
+  char *region_;
+  char *start_; // heapStart: first header
+  char *end_;   // heapEnd: end of the last block
+  char *max_;   // heapMax: end of the region
+};
+
+} // namespace myheap
+
+#endif
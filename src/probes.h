@@ -0,0 +1,42 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/**
+ * USDT probes on the allocator's slow paths, provider "myheap".
+ *
+ * With <sys/sdt.h> available (systemtap-sdt-dev) each probe compiles to a
+ * single NOP plus an ELF note, so they are always built in and cost nothing
+ * until a tracer attaches, e.g.
+ *   bpftrace -e 'usdt:./app:myheap:oom { printf("%d\n", arg1); }'
+ *   bpftrace -l 'usdt:./app:myheap:*'
+ * Build with -DHEAP_NO_USDT to leave them out entirely.
+ *
+ * Probes:
+ *   init(heap, size)                  a heap was created or attached
+ *   grow(heap, bytes, committed)      the top chunk or a large object
+ *                                     committed bytes more, committed in all
+ *   oom(heap, size)                   a request could not be served
+ *   coalesce(heap, mergedSize)        a free block absorbed its successors
+ *   purge(heap, releasedBytes)        pages went back to the OS: a
+ *                                     maintenance pass, a trim, a reclaim,
+ *                                     a large object shrinking or freed
+ */
+
+#if !defined(HEAP_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HEAP_USDT 1
+#endif
+#endif
+
+#ifdef HEAP_USDT
+#define HEAP_PROBE1(name, a) DTRACE_PROBE1(myheap, name, a)
+#define HEAP_PROBE2(name, a, b) DTRACE_PROBE2(myheap, name, a, b)
+#define HEAP_PROBE3(name, a, b, c) DTRACE_PROBE3(myheap, name, a, b, c)
+#else
+#define HEAP_PROBE1(name, a) ((void)0)
+#define HEAP_PROBE2(name, a, b) ((void)0)
+#define HEAP_PROBE3(name, a, b, c) ((void)0)
+#endif
+
+#endif
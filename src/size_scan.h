@@ -0,0 +1,116 @@
+#ifndef SIZE_SCAN_H
+#define SIZE_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/**
+ * First-fit search over a dense array of block sizes.
+ *
+ * Chasing headers is latency bound: every step waits for the load that
+ * tells where the next header is. With the sizes of all free blocks in one
+ * uint32_t array (in address order, see MYHEAP_FREE_INDEX) the search is a
+ * linear scan instead, compared 16 entries per loop iteration:
+ * - x86: AVX2 (two 8-lane compares) or SSE4.1 (four 4-lane compares),
+ *   picked at run time from CPUID, else a scalar loop
+ * - arm64: NEON, which every arm64 CPU has
+ * Unsigned x >= need is computed as max(x, need) == x, since the compare
+ * instructions are signed.
+ */
+
+static size_t scan_scalar(const uint32_t *sizes, size_t n, uint32_t need) {
+  size_t i = 0;
+  while (i < n && sizes[i] < need)
+    i++;
+  return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static size_t
+scan_avx2(const uint32_t *sizes, size_t n, uint32_t need) {
+  __m256i v = _mm256_set1_epi32((int)need);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(sizes + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(sizes + i + 8));
+    __m256i ga = _mm256_cmpeq_epi32(_mm256_max_epu32(a, v), a);
+    __m256i gb = _mm256_cmpeq_epi32(_mm256_max_epu32(b, v), b);
+    unsigned mask =
+        (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(ga)) |
+        (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(gb)) << 8;
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + scan_scalar(sizes + i, n - i, need);
+}
+
+__attribute__((target("sse4.1"))) static size_t
+scan_sse41(const uint32_t *sizes, size_t n, uint32_t need) {
+  __m128i v = _mm_set1_epi32((int)need);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    unsigned mask = 0;
+    for (int k = 0; k < 4; k++) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(sizes + i + 4 * k));
+      __m128i ge = _mm_cmpeq_epi32(_mm_max_epu32(a, v), a);
+      mask |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(ge)) << (4 * k);
+    }
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + scan_scalar(sizes + i, n - i, need);
+}
+#elif defined(__aarch64__)
+static size_t scan_neon(const uint32_t *sizes, size_t n, uint32_t need) {
+  uint32x4_t v = vdupq_n_u32(need);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint32x4_t ge = vorrq_u32(
+        vorrq_u32(vcgeq_u32(vld1q_u32(sizes + i), v),
+                  vcgeq_u32(vld1q_u32(sizes + i + 4), v)),
+        vorrq_u32(vcgeq_u32(vld1q_u32(sizes + i + 8), v),
+                  vcgeq_u32(vld1q_u32(sizes + i + 12), v)));
+    // Something in these 16 fits: the scalar loop finds the first one
+    if (vmaxvq_u32(ge))
+      return i + scan_scalar(sizes + i, 16, need);
+  }
+  return i + scan_scalar(sizes + i, n - i, need);
+}
+#endif
+
+typedef size_t (*sizeScanFn)(const uint32_t *, size_t, uint32_t);
+
+static sizeScanFn size_scan_pick(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return scan_avx2;
+  if (__builtin_cpu_supports("sse4.1"))
+    return scan_sse41;
+  return scan_scalar;
+#elif defined(__aarch64__)
+  return scan_neon;
+#else
+  return scan_scalar;
+#endif
+}
+
+// Index of the first entry >= need, n if there is none
+static inline size_t sizeScanFirst(const uint32_t *sizes, size_t n,
+                                   uint32_t need) {
+  static sizeScanFn scan;
+  sizeScanFn fn = __atomic_load_n(&scan, __ATOMIC_RELAXED);
+  if (fn == NULL) {
+    // Idempotent, so threads racing here all store the same choice
+    fn = size_scan_pick();
+    __atomic_store_n(&scan, fn, __ATOMIC_RELAXED);
+  }
+  return fn(sizes, n, need);
+}
+
+#endif